@@ -2,6 +2,12 @@
 
 #include <algorithm>
 #include <fstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+#include <mpi.h>
 #include "boost/multi_array.hpp"
 #include <boost/random.hpp>
 #include <boost/random/uniform_01.hpp>
@@ -11,6 +17,7 @@
 #include "types.h"
 #include "util.h"
 #include <alps/params.hpp>
+#include <alps/mpi.hpp>
 
 
 namespace alps {
@@ -19,31 +26,41 @@ namespace alps {
         typedef size_t vertex_t;
         typedef size_t af_t;
 
+        //All vertices have this rank (checked when they are read).
+        //Loops over the (c^dagger c) pairs of a vertex use this constant so that they are unrolled at compile time.
+        constexpr int VERTEX_RANK = 2;
+
         class itime_vertex;
         class all_type;
         class density_type;
         class non_density_type;
-        class non_density_type_in_window;
 
         template<class T>
         class vertex_definition
         {
         public:
-            vertex_definition() : rank_(-1), num_af_states_(-1), Uval_(0.0), id_(-1) {
+            vertex_definition() : num_af_states_(-1), Uval_(0.0), id_(-1) {
             }
 
-            vertex_definition(size_t rank, size_t num_af_states, std::vector<spin_t>& flavors, std::vector<size_t>& sites, T Uval, boost::multi_array<T,2>& alpha_af_rank, int id)
-              : rank_(rank),
-                flavors_(flavors),
+            //a vertex consists of VERTEX_RANK (cdagger c)
+            vertex_definition(size_t num_af_states, std::vector<spin_t>& flavors, std::vector<size_t>& sites, T Uval, boost::multi_array<T,2>& alpha_af_rank, int id)
+              : flavors_(flavors),
                 sites_(sites),
                 num_af_states_(num_af_states),
                 Uval_(Uval),
-                alpha_af_rank_(alpha_af_rank),
+                alpha_af_rank_(num_af_states*VERTEX_RANK),
+                alpha_af_rank_input_(num_af_states*VERTEX_RANK),
                 id_(id) {
-              assert(flavors_.size()==rank);
-              assert(sites.size()==2*rank);
-              assert(alpha_af_rank_.shape()[0]==num_af_states_);
-              assert(alpha_af_rank_.shape()[1]==rank);
+              assert(flavors_.size()==VERTEX_RANK);
+              assert(sites.size()==2*VERTEX_RANK);
+              assert(alpha_af_rank.shape()[0]==num_af_states_);
+              assert(alpha_af_rank.shape()[1]==VERTEX_RANK);
+              for (size_t iaf=0; iaf<num_af_states; ++iaf) {
+                for (size_t i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
+                  alpha_af_rank_[iaf*VERTEX_RANK+i_rank] = alpha_af_rank[iaf][i_rank];
+                }
+              }
+              alpha_af_rank_input_ = alpha_af_rank_;
             };
 
             const std::vector<spin_t>& flavors() const {
@@ -58,16 +75,13 @@ namespace alps {
               return Uval_;
             }
 
-            size_t rank() const {
-              return rank_;
-            }
-
             size_t num_af_states() const {
               return num_af_states_;
             }
 
             T get_alpha(size_t af_state, size_t idx_rank) const {
-              return alpha_af_rank_[af_state][idx_rank];
+              assert(af_state<num_af_states_ && idx_rank<VERTEX_RANK);
+              return alpha_af_rank_[af_state*VERTEX_RANK+idx_rank];
             }
 
             /**
@@ -75,7 +89,7 @@ namespace alps {
              */
             bool is_density_type() const {
               bool flag = true;
-              for (int i_rank=0; i_rank<rank_; ++i_rank) {
+              for (int i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
                 if (sites_[2*i_rank] != sites_[2*i_rank+1]) {
                   flag = false;
                   break;
@@ -86,7 +100,7 @@ namespace alps {
 
             bool is_truely_non_density_type() const {
               bool flag = true;
-              for (int i_rank=0; i_rank<rank_; ++i_rank) {
+              for (int i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
                 flag = flag && (sites_[2*i_rank] != sites_[2*i_rank+1]);
               }
               return flag;
@@ -94,20 +108,52 @@ namespace alps {
 
             int id() const {return id_;}
 
+            /**
+             * Scale the deviation of each alpha given at construction from the nearer of 0 and 1 by "scale"
+             * (e.g. delta -> scale*delta for alpha = 1+delta, -delta).
+             * For each (cdagger c), the common part of the deviations is restored afterwards so that the average of alpha
+             * over the auxiliary spin states, which determines the one-body terms of the interaction, is not changed.
+             */
+            void set_alpha_shift_scale(double scale) {
+              std::vector<T> deviation(alpha_af_rank_.size());
+              std::vector<double> alpha0(alpha_af_rank_.size());
+              for (size_t i=0; i<alpha_af_rank_.size(); ++i) {
+                const T alpha = alpha_af_rank_input_[i];
+                alpha0[i] = std::abs(alpha) < std::abs(alpha-1.0) ? 0.0 : 1.0;
+                deviation[i] = alpha-alpha0[i];
+              }
+              std::vector<T> alpha_new(alpha_af_rank_.size());
+              for (size_t i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
+                T mean_deviation = 0.0;
+                for (size_t iaf=0; iaf<num_af_states_; ++iaf) {
+                  mean_deviation += deviation[iaf*VERTEX_RANK+i_rank];
+                }
+                mean_deviation /= static_cast<double>(num_af_states_);
+                for (size_t iaf=0; iaf<num_af_states_; ++iaf) {
+                  const size_t i = iaf*VERTEX_RANK+i_rank;
+                  alpha_new[i] = alpha0[i] + scale*deviation[i] - (scale-1.0)*mean_deviation;
+                  if (std::abs(alpha_new[i]-alpha0[i]) >= 0.5) {
+                    throw std::runtime_error("Scaled alpha must be closer to the same one of 0 and 1 as the original alpha.");
+                  }
+                }
+              }
+              alpha_af_rank_ = alpha_new;
+            }
+
         private:
-            size_t rank_;
             std::vector<spin_t> flavors_;
             std::vector<size_t> sites_;
             size_t num_af_states_;
             T Uval_;
-            boost::multi_array<T,2> alpha_af_rank_;//first index addresses af spin state, second one addresses (cdagger c)
+            std::vector<T> alpha_af_rank_;//flat array: af spin state runs slowest, (cdagger c) runs fastest
+            std::vector<T> alpha_af_rank_input_;//alpha given at construction
             int id_;
         };
 
 
         template<class T>
         std::ostream& operator<<(std::ostream& os, const vertex_definition<T>& v) {
-          os << " rank= " << v.rank();
+          os << " rank= " << VERTEX_RANK;
           os << " flavors = ";
           for (auto f : v.flavors()) {
             os << f;
@@ -118,7 +164,7 @@ namespace alps {
           }
           os << " num_af_states = " << v.num_af_states();
           for (int iaf = 0; iaf < v.num_af_states(); ++iaf) {
-            for (int rank = 0; rank < v.rank(); ++rank) {
+            for (int rank = 0; rank < VERTEX_RANK; ++rank) {
               std::cout << " ( " << iaf << "," << rank << "," << v.get_alpha(iaf, rank) << ") ";
             }
           }
@@ -127,6 +173,135 @@ namespace alps {
         }
 
 
+        /**
+         * Vertex definitions packed into a flat buffer (used for the binary file format and for MPI broadcast):
+         * num_vertices, then for each vertex
+         *   rank, num_af_states, Re U, Im U, sites (2*rank), flavors (rank), (Re alpha, Im alpha) for i_rank, iaf (iaf runs fastest).
+         * The ordering follows that of the text format.
+         */
+        namespace U_matrix_file {
+            const char binary_magic[8] = {'C', 'T', 'I', 'N', 'T', 'U', 'M', 'B'};
+            const boost::uint64_t binary_version = 1;
+
+            inline std::vector<double> read_text(const std::string &filename) {
+              std::ifstream ifs(filename.c_str());
+              if (!ifs.is_open()) {
+                throw std::runtime_error(filename+" does not exist!");
+              }
+              size_t num_nonzero;
+              ifs >> num_nonzero;
+
+              std::vector<double> packed;
+              packed.push_back(num_nonzero);
+              long rank, num_af_states, ival;
+              std::complex<double> cval;
+              for (size_t idx=0; idx<num_nonzero; ++idx) {
+                size_t itmp;
+                ifs >> itmp >> rank >> num_af_states >> cval;
+                if (!ifs || itmp != idx) {
+                  throw std::runtime_error("Error in reading the definition of vertex " + std::to_string(idx) + " from " + filename);
+                }
+                packed.push_back(rank);
+                packed.push_back(num_af_states);
+                packed.push_back(cval.real());
+                packed.push_back(cval.imag());
+                for (long i=0; i<3*rank; ++i) {//sites and flavors
+                  ifs >> ival;
+                  packed.push_back(ival);
+                }
+                for (long i=0; i<rank*num_af_states; ++i) {
+                  ifs >> cval;
+                  packed.push_back(cval.real());
+                  packed.push_back(cval.imag());
+                }
+                if (!ifs) {
+                  throw std::runtime_error("Error in reading the definition of vertex " + std::to_string(idx) + " from " + filename);
+                }
+              }
+              return packed;
+            }
+
+            inline bool is_binary(const std::string &filename) {
+              std::ifstream ifs(filename.c_str(), std::ios::binary);
+              char magic[sizeof(binary_magic)];
+              return ifs.read(magic, sizeof(magic)) && std::equal(magic, magic+sizeof(magic), binary_magic);
+            }
+
+            inline std::vector<double> read_binary(const std::string &filename) {
+              std::ifstream ifs(filename.c_str(), std::ios::binary);
+              if (!ifs.is_open()) {
+                throw std::runtime_error(filename+" does not exist!");
+              }
+              char magic[sizeof(binary_magic)];
+              boost::uint64_t version, size;
+              ifs.read(magic, sizeof(magic));
+              ifs.read(reinterpret_cast<char*>(&version), sizeof(version));
+              ifs.read(reinterpret_cast<char*>(&size), sizeof(size));
+              if (!ifs || !std::equal(magic, magic+sizeof(magic), binary_magic) || version != binary_version) {
+                throw std::runtime_error(filename+" is not a supported binary U-matrix file.");
+              }
+              std::vector<double> packed(size);
+              ifs.read(reinterpret_cast<char*>(packed.data()), size*sizeof(double));
+              if (!ifs) {
+                throw std::runtime_error(filename+" is truncated.");
+              }
+              return packed;
+            }
+
+            inline void write_binary(const std::string &filename, const std::vector<double> &packed) {
+              std::ofstream ofs(filename.c_str(), std::ios::binary);
+              if (!ofs.is_open()) {
+                throw std::runtime_error("Cannot open " + filename);
+              }
+              const boost::uint64_t size = packed.size();
+              ofs.write(binary_magic, sizeof(binary_magic));
+              ofs.write(reinterpret_cast<const char*>(&binary_version), sizeof(binary_version));
+              ofs.write(reinterpret_cast<const char*>(&size), sizeof(size));
+              ofs.write(reinterpret_cast<const char*>(packed.data()), size*sizeof(double));
+              if (!ofs) {
+                throw std::runtime_error("Error in writing " + filename);
+              }
+            }
+
+            //the format is detected from the header of the file
+            inline std::vector<double> read(const std::string &filename) {
+              return is_binary(filename) ? read_binary(filename) : read_text(filename);
+            }
+        }
+
+        /**
+         * Read vertex definitions on rank 0 and broadcast them to all the other ranks.
+         * If MPI is not initialized (e.g. in unit tests), the file is read by the calling process.
+         */
+        inline std::vector<double> broadcast_packed_vertices(const std::string &filename) {
+          int mpi_initialized = 0;
+          MPI_Initialized(&mpi_initialized);
+          if (!mpi_initialized) {
+            return U_matrix_file::read(filename);
+          }
+
+          alps::mpi::communicator comm;
+          std::vector<double> packed;
+          std::string error_message;
+          long size = -1;
+          if (comm.rank() == 0) {
+            try {
+              packed = U_matrix_file::read(filename);
+              size = packed.size();
+            } catch (const std::exception &e) {
+              error_message = e.what();
+            }
+          }
+          MPI_Bcast(&size, 1, MPI_LONG, 0, comm);
+          if (size < 0) {
+            throw std::runtime_error(comm.rank() == 0 ? error_message : "Failed to read " + filename + " on rank 0.");
+          }
+          packed.resize(size);
+          MPI_Bcast(packed.data(), static_cast<int>(size), MPI_DOUBLE, 0, comm);
+          return packed;
+        }
+
+
 //Data structure for general two-body interactions for a multi-orbital cluster impurity problem
         template<class T>
         class general_U_matrix {
@@ -145,64 +320,17 @@ namespace alps {
               }
             }
 
+            /**
+             * Vertex definitions are read on rank 0 only (either from a text file or from a binary file created by ctint_convert_U_matrix)
+             * and broadcast to the other ranks as a packed buffer.
+             */
             void load_vertex_from_file(const alps::params &parms) {
               if (!parms.supplied("model.U_matrix_file")) {
                 throw std::runtime_error("Error: model.U_matrix_file is not set!");
               }
               std::string ufilename(parms["model.U_matrix_file"].template as<std::string>());
-              std::ifstream ifs(ufilename.c_str());
-              if (!ifs.is_open()) {
-                throw std::runtime_error(ufilename+" does not exist!");
-              }
-              ifs >> num_nonzero_;
-
-              //temporary
-              size_t rank, num_af_states;
-              T Uval_;
-              std::complex<double> Uval_cmplx;
-              std::vector<size_t> site_indices_;//site indices (ijkl)
-              std::vector<spin_t> flavor_indices_;//flavor indices for c^dagger c
-              boost::multi_array<T,2> alpha_;//the first index is auxially spin, the second denotes (ij) or (kl).
-              boost::multi_array<std::complex<double>,2> alpha_cmplx;//tempolary
-
-              for (unsigned int idx=0; idx<num_nonzero_; ++idx) {
-                size_t itmp;
-                ifs >> itmp >> rank >> num_af_states >> Uval_cmplx;
-                Uval_ = mycast<T>(Uval_cmplx);
-                assert(itmp==idx);
-                assert(rank==2);
-
-                site_indices_.resize(2*rank);
-                flavor_indices_.resize(rank);
-                alpha_.resize(boost::extents[num_af_states][rank]);
-                alpha_cmplx.resize(boost::extents[num_af_states][rank]);
-
-                for (size_t i_op=0; i_op<2*rank; ++i_op) {
-                  ifs >> site_indices_[i_op];//i, j, k, l
-                  if (site_indices_[i_op] < 0 || site_indices_[i_op] >= ns_) {
-                    throw std::runtime_error("Wrong site index is given in the definition of vertex.");
-                  }
-                }
-                for (size_t i_rank=0; i_rank<rank; ++i_rank) {
-                  ifs >> flavor_indices_[i_rank];
-                  if (flavor_indices_[i_rank] < 0 || flavor_indices_[i_rank] >= nf_) {
-                    throw std::runtime_error("Wrong flavor index is given in the definition of vertex.");
-                  }
-                }
-                for (size_t i_rank=0; i_rank<rank; ++i_rank) {
-                  for (size_t iaf=0; iaf<num_af_states; ++iaf) {
-                    ifs >> alpha_cmplx[iaf][i_rank];
-                  }
-                }
-                for (size_t i_rank=0; i_rank<rank; ++i_rank) {
-                  for (size_t iaf = 0; iaf < num_af_states; ++iaf) {
-                    alpha_[iaf][i_rank] = mycast<T>(static_cast<std::complex<double> >(alpha_cmplx[iaf][i_rank]));
-                  }
-                }
-
-                vertex_list.push_back(vertex_definition<T>(rank, num_af_states, flavor_indices_, site_indices_, Uval_, alpha_, idx));
-              }
-
+              unpack_vertices(broadcast_packed_vertices(ufilename));
+              validate_vertices();
               find_non_density_vertices();
             }
 
@@ -219,7 +347,7 @@ namespace alps {
               }
 
               const int num_af_states = 2;
-              const int rank = 2;
+              const int rank = VERTEX_RANK;
 
               std::vector<size_t> site_indices_;//site indices (ijkl)
               std::vector<spin_t> flavor_indices_;//flavor indices for c^dagger c
@@ -265,7 +393,7 @@ namespace alps {
                   alpha_[1][1] = 1+delta;
                 }
 
-                vertex_list.push_back(vertex_definition<T>(rank, num_af_states, flavor_indices_, site_indices_, U, alpha_, site));
+                vertex_list.push_back(vertex_definition<T>(num_af_states, flavor_indices_, site_indices_, U, alpha_, site));
               }
 
               find_non_density_vertices();
@@ -302,10 +430,6 @@ namespace alps {
               return density_vertices;
             }
 
-            const std::vector<vertex_definition<T> >& get_vertices(non_density_type_in_window& pred) const {
-              return non_density_vertices;
-            }
-
             const std::vector<vertex_definition<T> >& get_non_density_vertex_defs() const {
               return non_density_vertices;
             }
@@ -322,10 +446,6 @@ namespace alps {
               return density_vertices.size();
             }
 
-            int num_vertex_type(non_density_type_in_window& pred) const {
-              return non_density_vertices.size();
-            }
-
             int num_density_vertex_type() const {
               return density_vertices.size();
             }
@@ -334,16 +454,231 @@ namespace alps {
               return is_truely_non_density_type;
             }
 
+            /**
+             * Rewrite the vertices in the basis d_a = sum_i V[flavor](i,a) c_i (V[flavor] is orthogonal).
+             *
+             * Each factor is expanded as c^dagger_i c_j - alpha = sum_{ab} V(i,a) V(j,b) (d^dagger_a d_b - alpha delta_{ab}).
+             * The resulting pairs with a=b keep the alpha values of the original pair.
+             * Those with a!=b get alpha = +delta (-delta) in the first (second) half of the auxiliary spin states,
+             * so that their average over the auxiliary spin states does not produce one-body terms.
+             * delta is the smallest deviation of the input alpha values from 0 or 1.
+             * Terms with the same operators and alpha values are merged and those smaller than cutoff*max|U| are dropped.
+             * This preserves the one-body terms only if the alpha values of every input pair with i!=j average to zero,
+             * which is checked.
+             */
+            void rotate_basis(const std::vector<Eigen::MatrixXd>& V, double cutoff = 1e-10) {
+              if (V.size() != nf_) {
+                throw std::invalid_argument("The number of rotation matrices must be equal to the number of flavors.");
+              }
+
+              double delta = 0.5, max_abs_U = 0.0;
+              for (const auto& v : vertex_list) {
+                max_abs_U = std::max(max_abs_U, static_cast<double>(std::abs(v.Uval())));
+                for (int i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
+                  T mean_alpha = 0.0;
+                  for (size_t iaf=0; iaf<v.num_af_states(); ++iaf) {
+                    const T alpha = v.get_alpha(iaf, i_rank);
+                    mean_alpha += alpha;
+                    delta = std::min(delta, static_cast<double>(std::min(std::abs(alpha), std::abs(alpha-1.0))));
+                  }
+                  mean_alpha /= static_cast<double>(v.num_af_states());
+                  if (v.sites()[2*i_rank] != v.sites()[2*i_rank+1] && std::abs(mean_alpha) > 1e-12) {
+                    throw std::invalid_argument("Basis rotation requires the alpha values of non-density pairs to average to zero.");
+                  }
+                }
+              }
+
+              //key: flavors, sites and alpha values
+              std::map<std::vector<double>, size_t> index;
+              std::vector<std::vector<double> > keys;
+              std::vector<T> Uval;
+              std::vector<double> key;
+              for (const auto& v : vertex_list) {
+                const size_t num_af_states = v.num_af_states();
+                const Eigen::MatrixXd &V0 = V[v.flavors()[0]], &V1 = V[v.flavors()[1]];
+                const size_t i = v.sites()[0], j = v.sites()[1], k = v.sites()[2], l = v.sites()[3];
+                for (size_t a=0; a<ns_; ++a) {
+                for (size_t b=0; b<ns_; ++b) {
+                  if (V0(i,a)*V0(j,b) == 0.0) continue;
+                  for (size_t c=0; c<ns_; ++c) {
+                  for (size_t d=0; d<ns_; ++d) {
+                    const double coeff = V0(i,a)*V0(j,b)*V1(k,c)*V1(l,d);
+                    if (coeff == 0.0) continue;
+                    const size_t pair_sites[2][2] = {{a, b}, {c, d}};
+
+                    key.assign({1.0*v.flavors()[0], 1.0*v.flavors()[1], 1.0*a, 1.0*b, 1.0*c, 1.0*d, 1.0*num_af_states});
+                    for (size_t iaf=0; iaf<num_af_states; ++iaf) {
+                      for (int i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
+                        std::complex<double> alpha;
+                        if (pair_sites[i_rank][0] == pair_sites[i_rank][1]) {
+                          alpha = v.get_alpha(iaf, i_rank);
+                        } else {
+                          if (num_af_states % 2 != 0) {
+                            throw std::runtime_error("Basis rotation requires an even number of auxiliary spin states.");
+                          }
+                          alpha = 2*iaf < num_af_states ? delta : -delta;
+                        }
+                        key.push_back(alpha.real());
+                        key.push_back(alpha.imag());
+                      }
+                    }
+
+                    auto it = index.find(key);
+                    if (it == index.end()) {
+                      index[key] = keys.size();
+                      keys.push_back(key);
+                      Uval.push_back(coeff*v.Uval());
+                    } else {
+                      Uval[it->second] += coeff*v.Uval();
+                    }
+                  }
+                  }
+                }
+                }
+              }
+
+              vertex_list.clear();
+              std::vector<size_t> site_indices_(2*VERTEX_RANK);
+              std::vector<spin_t> flavor_indices_(VERTEX_RANK);
+              boost::multi_array<T,2> alpha_;
+              for (size_t iv=0; iv<keys.size(); ++iv) {
+                if (std::abs(Uval[iv]) <= cutoff*max_abs_U) {
+                  continue;
+                }
+                const std::vector<double>& k = keys[iv];
+                const size_t num_af_states = static_cast<size_t>(k[6]);
+                for (int i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
+                  flavor_indices_[i_rank] = static_cast<spin_t>(k[i_rank]);
+                }
+                for (int i_op=0; i_op<2*VERTEX_RANK; ++i_op) {
+                  site_indices_[i_op] = static_cast<size_t>(k[2+i_op]);
+                }
+                alpha_.resize(boost::extents[num_af_states][VERTEX_RANK]);
+                for (size_t iaf=0; iaf<num_af_states; ++iaf) {
+                  for (int i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
+                    const size_t pos = 7 + 2*(iaf*VERTEX_RANK + i_rank);
+                    alpha_[iaf][i_rank] = mycast<T>(std::complex<double>(k[pos], k[pos+1]));
+                  }
+                }
+                vertex_list.push_back(vertex_definition<T>(num_af_states, flavor_indices_, site_indices_, Uval[iv], alpha_, vertex_list.size()));
+              }
+              num_nonzero_ = vertex_list.size();
+
+              validate_vertices();
+              find_non_density_vertices();
+            }
+
+            /**
+             * Rescale the shifts of all alpha values from 0 or 1 relative to the input (delta for model.U),
+             * keeping their averages over the auxiliary spin states (see vertex_definition::set_alpha_shift_scale).
+             * The vertices are not modified if the scaled alpha values are invalid.
+             * Walkers built with the old alpha values must be rebuilt.
+             */
+            void set_alpha_shift_scale(double scale) {
+              if (scale <= 0.0) {
+                throw std::invalid_argument("The scale of the shifts of alpha must be positive.");
+              }
+              std::vector<vertex_definition<T> > vertex_list_new(vertex_list);
+              for (auto& v : vertex_list_new) {
+                v.set_alpha_shift_scale(scale);
+              }
+              vertex_list.swap(vertex_list_new);
+              validate_vertices();
+              find_non_density_vertices();
+            }
+
         private:
             unsigned int ns_, nf_, num_nonzero_;
             std::vector<vertex_definition<T> > vertex_list, non_density_vertices, density_vertices;
             //std::vector<int> non_density_vertices;
             std::vector<bool> is_density_type, is_truely_non_density_type;
 
+            void unpack_vertices(const std::vector<double>& packed) {
+              size_t pos = 0;
+              auto next = [&]() {
+                if (pos >= packed.size()) {
+                  throw std::runtime_error("Vertex definitions are truncated.");
+                }
+                return packed[pos++];
+              };
+              auto next_size = [&]() {
+                const double val = next();
+                if (val < 0) {
+                  throw std::runtime_error("Negative index or size is given in the definition of vertex.");
+                }
+                return static_cast<size_t>(val);
+              };
+
+              num_nonzero_ = next_size();
+              vertex_list.clear();
+              vertex_list.reserve(num_nonzero_);
+
+              std::vector<size_t> site_indices_;//site indices (ijkl)
+              std::vector<spin_t> flavor_indices_;//flavor indices for c^dagger c
+              boost::multi_array<T,2> alpha_;//the first index is auxially spin, the second denotes (ij) or (kl).
+              for (unsigned int idx=0; idx<num_nonzero_; ++idx) {
+                const size_t rank = next_size();
+                if (rank != VERTEX_RANK) {
+                  throw std::runtime_error("Only rank-2 vertices are supported.");
+                }
+                const size_t num_af_states = next_size();
+                const double U_re = next();
+                const T Uval_ = mycast<T>(std::complex<double>(U_re, next()));
+
+                site_indices_.resize(2*rank);
+                flavor_indices_.resize(rank);
+                alpha_.resize(boost::extents[num_af_states][rank]);
+                for (size_t i_op=0; i_op<2*rank; ++i_op) {
+                  site_indices_[i_op] = next_size();
+                }
+                for (size_t i_rank=0; i_rank<rank; ++i_rank) {
+                  flavor_indices_[i_rank] = static_cast<spin_t>(next_size());
+                }
+                for (size_t i_rank=0; i_rank<rank; ++i_rank) {
+                  for (size_t iaf=0; iaf<num_af_states; ++iaf) {
+                    const double alpha_re = next();
+                    alpha_[iaf][i_rank] = mycast<T>(std::complex<double>(alpha_re, next()));
+                  }
+                }
+                vertex_list.push_back(vertex_definition<T>(num_af_states, flavor_indices_, site_indices_, Uval_, alpha_, idx));
+              }
+              if (pos != packed.size()) {
+                throw std::runtime_error("Vertex definitions contain trailing data.");
+              }
+            }
+
+            //done once after all vertices have been read
+            void validate_vertices() const {
+              for (const auto& v : vertex_list) {
+                if (v.num_af_states() == 0) {
+                  throw std::runtime_error("A vertex must have at least one auxiliary spin state.");
+                }
+                for (auto site : v.sites()) {
+                  if (site >= ns_) {
+                    throw std::runtime_error("Wrong site index is given in the definition of vertex.");
+                  }
+                }
+                for (auto flavor : v.flavors()) {
+                  if (flavor >= nf_) {
+                    throw std::runtime_error("Wrong flavor index is given in the definition of vertex.");
+                  }
+                }
+                for (size_t iaf=0; iaf<v.num_af_states(); ++iaf) {
+                  for (size_t i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
+                    //f(alpha)=alpha/(alpha-1) must be finite and non-zero, otherwise a vertex cannot be removed in submatrix updates
+                    if (v.get_alpha(iaf, i_rank)==0.0 || v.get_alpha(iaf, i_rank)==1.0) {
+                      throw std::runtime_error("alpha must be neither 0 nor 1 in the definition of vertex.");
+                    }
+                  }
+                }
+              }
+            }
+
             void find_non_density_vertices() {
               is_density_type.resize(vertex_list.size());
               is_truely_non_density_type.resize(vertex_list.size());
               non_density_vertices.clear();
+              density_vertices.clear();
               for (int iv=0; iv<vertex_list.size(); ++iv) {
                 is_density_type[iv] = vertex_list[iv].is_density_type();
                 is_truely_non_density_type[iv] = vertex_list[iv].is_truely_non_density_type();
@@ -362,17 +697,16 @@ namespace alps {
             itime_vertex()
               : vertex_type_(-1),
                 af_state_(-1),
-                rank_(-1),
                 time_(-1),
                 is_density_type_(false),
                 is_non_interacting_(false),
                 unique_id_(0)
             {}
 
-            itime_vertex(int vertex_type, int af_state, double time, int rank, bool is_density_type)
+            //a vertex consists of VERTEX_RANK (cdagger c)
+            itime_vertex(int vertex_type, int af_state, double time, bool is_density_type)
               : vertex_type_(vertex_type),
                 af_state_(af_state),
-                rank_(rank),
                 time_(time),
                 is_density_type_(is_density_type),
                 is_non_interacting_(false),
@@ -382,7 +716,6 @@ namespace alps {
             int af_state() const { return af_state_; }
             int vertex_type() const {return vertex_type_;}
             int type() const {return vertex_type_;}
-            int rank() const {return rank_;}
             double time() const {return time_;}
             void set_time(double new_time) {time_ = new_time;}
             void set_af_state(int new_af_state) {af_state_ = new_af_state;}
@@ -395,64 +728,178 @@ namespace alps {
             my_uint64 unique_id() const {return unique_id_;}
 
         private:
-            int vertex_type_, af_state_, rank_;
+            int vertex_type_, af_state_;
             double time_;
             bool is_density_type_; //, is_truely_non_density_type_;
             bool is_non_interacting_;
             my_uint64 unique_id_;
         };
 
+        /**
+         * Vertices on the imaginary-time axis
+         *
+         * The position of a vertex in the container does not change until it or a vertex before it is removed.
+         * The container maintains the number of interacting vertices.
+         * The positions of the interacting vertices are also kept per vertex type (in no particular order),
+         * which allows to count and sample vertices of given types in O(number of types).
+         * Vertices are modified only through the member functions of the container so that these are kept up to date.
+         */
         template<class V>
-        class ItimeVertexContainer : private std::vector<V> {
+        class ItimeVertexContainer {
         public:
-            ItimeVertexContainer() : std::vector<V>() {};
-            ItimeVertexContainer(const ItimeVertexContainer& x) : std::vector<V>(x) {};
-            ItimeVertexContainer(size_t count) : std::vector<V>(count) {};
+            typedef typename std::vector<V>::const_iterator const_iterator;
+            typedef const_iterator iterator;
 
-            ItimeVertexContainer<V>& operator=(const ItimeVertexContainer<V>& x) {
-              std::vector<V>::operator=(x);
-              return *this;
+            ItimeVertexContainer() : num_interacting_(0) {};
+
+            int size() const {
+              return vertices_.size();
             }
 
-            typedef typename std::vector<V>::iterator iterator;
-            typedef typename std::vector<V>::const_iterator const_iterator;
+            const V& operator[](int index) const {
+              return vertices_[index];
+            }
+
+            const_iterator begin() const {
+              return vertices_.begin();
+            }
+
+            const_iterator end() const {
+              return vertices_.end();
+            }
 
+            //O(1)
             int num_interacting() const {
-              int count = 0;
+              return num_interacting_;
+            }
+
+            int num_non_interacting() const {
+              return size() - num_interacting_;
+            }
+
+            //O(1)
+            int num_interacting(int type) const {
+              return type < positions_by_type_.size() ? positions_by_type_[type].size() : 0;
+            }
+
+            //Positions of the interacting vertices of the given type (in no particular order)
+            const std::vector<int>& interacting_positions(int type) const {
+              static const std::vector<int> empty;
+              return type < positions_by_type_.size() ? positions_by_type_[type] : empty;
+            }
+
+            void push_back(const V& x) {
+              assert(!has_vertex_at(x.time()));
+              vertices_.push_back(x);
+              index_in_type_.push_back(-1);
+              if (!x.is_non_interacting()) {
+                add_to_type_list(size() - 1);
+              }
+            }
+
+            void pop_back() {
+              assert(size() > 0);
+              if (!vertices_.back().is_non_interacting()) {
+                remove_from_type_list(size() - 1);
+              }
+              vertices_.pop_back();
+              index_in_type_.pop_back();
+            }
+
+            void clear() {
+              vertices_.clear();
+              index_in_type_.clear();
+              positions_by_type_.clear();
+              num_interacting_ = 0;
+            }
+
+            //O(N): only for checks in debug mode
+            bool has_vertex_at(double time) const {
               for (int iv=0; iv<size(); ++iv) {
-                if(!operator[](iv).is_non_interacting()) ++count;
+                if (vertices_[iv].time() == time) {
+                  return true;
+                }
+              }
+              return false;
+            }
+
+            void set_time(int index, double new_time) {
+              assert(vertices_[index].time() == new_time || !has_vertex_at(new_time));
+              vertices_[index].set_time(new_time);
+            }
+
+            void set_interacting(int index) {
+              if (vertices_[index].is_non_interacting()) {
+                vertices_[index].set_interacting();
+                add_to_type_list(index);
               }
-              return count;
             }
 
-            //this is to be killed.
-            using std::vector<V>::size;
+            void set_non_interacting(int index) {
+              if (!vertices_[index].is_non_interacting()) {
+                vertices_[index].set_non_interacting();
+                remove_from_type_list(index);
+              }
+            }
 
-            using std::vector<V>::operator[];
-            //using std::vector<V>::push_back;
-            using std::vector<V>::resize;
-            using std::vector<V>::pop_back;
-            using std::vector<V>::begin;
-            using std::vector<V>::end;
-            using std::vector<V>::erase;
+            void set_af_state(int index, int new_af_state) {
+              vertices_[index].set_af_state(new_af_state);
+            }
 
-            //const V& operator[](unsigned int index) const {
-            //return operator[](index);
-            //}
+            void set_unique_id(int index, my_uint64 id) {
+              vertices_[index].set_unique_id(id);
+            }
 
-            void push_back(const V& x) {
-              bool equal_time = false;
+            /**
+             * Remove the non-interacting vertices in place keeping the order of the others: O(N)
+             * The unique ids of the removed vertices are appended to uid_removed.
+             */
+            void remove_non_interacting(std::vector<my_uint64>& uid_removed) {
+              int new_size = 0;
               for (int iv=0; iv<size(); ++iv) {
-                if (operator[](iv).time()==x.time()) {
-                  equal_time = true;
-                  break;
+                if (vertices_[iv].is_non_interacting()) {
+                  uid_removed.push_back(vertices_[iv].unique_id());
+                  continue;
                 }
+                if (new_size != iv) {
+                  vertices_[new_size] = vertices_[iv];
+                  index_in_type_[new_size] = index_in_type_[iv];
+                  positions_by_type_[vertices_[new_size].type()][index_in_type_[new_size]] = new_size;
+                }
+                ++new_size;
               }
-              if (equal_time) {
-                std::runtime_error("ItimeVertexContainer::push_back: you try to insert a vertex at the imaginary time where there is already a vertex.");
+              vertices_.resize(new_size);
+              index_in_type_.resize(new_size);
+            }
+
+        private:
+            void add_to_type_list(int index) {
+              const int type = vertices_[index].type();
+              assert(type >= 0);
+              if (type >= positions_by_type_.size()) {
+                positions_by_type_.resize(type + 1);
               }
-              std::vector<V>::push_back(x);
+              index_in_type_[index] = positions_by_type_[type].size();
+              positions_by_type_[type].push_back(index);
+              ++num_interacting_;
+            }
+
+            //O(1): the last entry of the list is moved to the hole
+            void remove_from_type_list(int index) {
+              std::vector<int>& list = positions_by_type_[vertices_[index].type()];
+              const int i = index_in_type_[index];
+              assert(i >= 0 && list[i] == index);
+              list[i] = list.back();
+              index_in_type_[list[i]] = i;
+              list.pop_back();
+              index_in_type_[index] = -1;
+              --num_interacting_;
             }
+
+            std::vector<V> vertices_;
+            int num_interacting_;
+            std::vector<std::vector<int> > positions_by_type_;//positions of interacting vertices of each type
+            std::vector<int> index_in_type_;//index of each vertex in positions_by_type_ (-1 for non-interacting vertices)
         };
 
         typedef ItimeVertexContainer<itime_vertex> itime_vertex_container;
@@ -515,56 +962,6 @@ public:
 */
 
 
-        class non_density_type_in_window : public std::unary_function<itime_vertex,bool> {
-        public:
-            non_density_type_in_window() :
-              ts_(0),
-              w_(0),
-              t_small1_(0),
-              t_large1_(1E+100),
-              t_small2_(0),
-              t_large2_(1E+100) {}
-
-            non_density_type_in_window(double ts, double w, double beta) : ts_(ts), w_(w), beta_(beta) {
-              assert(w<=beta);
-              if (ts+w<=beta) {
-                t_small1_ = t_small2_= ts;
-                t_large1_ = t_large2_ = ts+w;
-              } else {
-                t_small1_ = ts;
-                t_large1_ = beta;
-                t_small2_ = 0.0;
-                t_large2_ = w+ts-beta;
-              }
-              //std::cout << "t_s1,t_l1" << t_small1_ << " " << t_large1_ << std::endl;
-              //std::cout << "t_s2,t_l2" << t_small2_ << " " << t_large2_ << std::endl;
-            }
-
-            bool operator()(itime_vertex v) const {
-              const double t = v.time();
-              return !v.is_density_type() && ((t_small1_<=t && t<=t_large1_) || (t_small2_<=t && t<=t_large2_));
-            }
-
-            double random_time(double random01, double beta)  const{
-              assert(random01>=0 && random01<=1);
-              assert(beta_==beta);
-              assert(w_>0);
-              double t = random01*w_+ts_;
-              if (t>beta_) t -= beta_;
-              return t;
-            }
-
-            double width() {
-              assert(w_>0);
-              return w_;
-            }
-
-        private:
-            double ts_, w_, beta_;
-            double t_small1_, t_large1_;
-            double t_small2_, t_large2_;
-        };
-
         class all_type : public std::unary_function<itime_vertex,bool> {
         public:
             bool operator()(itime_vertex v) {return true;}
@@ -575,34 +972,6 @@ public:
             }
         };
 
-        template<class T, class R, class UnaryPredicate>
-        std::vector<itime_vertex> generate_valid_vertex_pair(const general_U_matrix<T>& Uijkl, const std::vector<std::tuple<int,int> >& valid_pair,
-                                                             R& random01, double beta, const UnaryPredicate& pred) {
-          const int n_vertices_add = 2;
-
-          std::vector<itime_vertex> itime_vertices;
-          itime_vertices.reserve(n_vertices_add);
-
-          if (valid_pair.size()==0)
-            return std::vector<itime_vertex>();
-
-          int v1,v2;
-          std::tie(v1,v2) = valid_pair[static_cast<int>(random01()*valid_pair.size())];
-          int vtypes[] = {v1, v2};
-
-          for (int iv=0; iv<n_vertices_add; ++iv) {
-            const double time = pred.random_time(random01(), beta);
-            const int v_type = vtypes[iv];
-            const int rank = Uijkl.get_vertices()[v_type].rank();
-            const int af_state = random01()*Uijkl.get_vertices()[v_type].num_af_states();
-            itime_vertices.push_back(itime_vertex(v_type, af_state, time, rank, false));
-            if(Uijkl.get_vertices()[v_type].is_density_type()) {
-              throw std::logic_error("Error found density type vertex");
-            }
-          }
-          return itime_vertices;
-        }
-
         template<class T, class R, class P>
         std::vector<itime_vertex> generate_valid_vertex_pair2(const general_U_matrix<T>& Uijkl, const std::pair<int,int> v_pair,
                                                               R& random01, double beta, const P& normalized_prob_dist) {
@@ -620,9 +989,8 @@ public:
           for (int iv=0; iv<n_vertices_add; ++iv) {
             const double time = times[iv];
             const int v_type = vtypes[iv];
-            const int rank = Uijkl.get_vertices()[v_type].rank();
             const int af_state = random01()*Uijkl.get_vertices()[v_type].num_af_states();
-            itime_vertices.push_back(itime_vertex(v_type, af_state, time, rank, false));
+            itime_vertices.push_back(itime_vertex(v_type, af_state, time, false));
             if(Uijkl.get_vertices()[v_type].is_density_type()) {
               throw std::logic_error("Error found density type vertex");
             }
@@ -645,134 +1013,74 @@ public:
             const double time = pred.random_time(random01(), beta);
             const int iv_rnd = static_cast<int>(random01()*n_valid_vs);
             const int v_type = valid_vs[iv_rnd].id();
-            const int rank = valid_vs[iv_rnd].rank();
             const int af_state = static_cast<size_t>(random01()*valid_vs[iv_rnd].num_af_states());
-            itime_vertices.push_back(itime_vertex(v_type, af_state, time, rank, valid_vs[iv_rnd].is_density_type()));
+            itime_vertices.push_back(itime_vertex(v_type, af_state, time, valid_vs[iv_rnd].is_density_type()));
           }
           return itime_vertices;
         }
 
-        template<class UnaryPredicate>
-        int count_valid_vertex_pair(const std::vector<itime_vertex>& itime_vertices, const boost::multi_array<bool,2>& valid_pair_flag, const UnaryPredicate& window) {
-          std::vector<int> vs_win; vs_win.reserve(itime_vertices.size());
-          std::vector<int> pos; pos.reserve(itime_vertices.size());
-
-          int idx = 0;
-          for (std::vector<itime_vertex>::const_iterator it=itime_vertices.begin(); it!=itime_vertices.end(); ++it) {
-            if (window(*it) && !it->is_density_type()) {
-              vs_win.push_back(it->type());
-              pos[vs_win.size()-1] = idx;
-            }
-            ++idx;
+        //Sum of p(tau - time) over the interacting vertices of the given type: O(number of vertices of the type)
+        template<class P>
+        double sum_pair_weights(const itime_vertex_container& itime_vertices, int type, double time, double beta, const P& p) {
+          const std::vector<int>& pos = itime_vertices.interacting_positions(type);
+          double F = 0.0;
+          for (int i=0; i<pos.size(); ++i) {
+            F += p.bare_value(mymod(itime_vertices[pos[i]].time()-time, beta));
           }
-
-          const int N = vs_win.size();
-          int N_valid_pair = 0;
-          for (int iv=0; iv<N; ++iv) {
-            for (int iv2=0; iv2<N; ++iv2) {
-              if (iv<=iv2)
-                continue;
-
-              if (valid_pair_flag[vs_win[iv]][vs_win[iv2]])
-                ++N_valid_pair;
-            }
-          }
-
-          return N_valid_pair;
+          return F;
         }
 
-        template<class UnaryPredicate, class R>
-        std::vector<int>
-        pick_up_valid_vertex_pair(const std::vector<itime_vertex>& itime_vertices, const boost::multi_array<bool,2>& valid_pair_flag, const UnaryPredicate& window, R& random01, int& N_valid_pair) {
-          std::vector<int> vs_win; vs_win.reserve(itime_vertices.size());
-          std::vector<int> pos; pos.reserve(itime_vertices.size());
-
-          int idx = 0;
-          for (std::vector<itime_vertex>::const_iterator it=itime_vertices.begin(); it!=itime_vertices.end(); ++it) {
-            if (window(*it) && !it->is_density_type()) {
-              vs_win.push_back(it->type());
-              pos.push_back(idx);
-            }
-            ++idx;
-          }
-
-          const int N = vs_win.size();
-          std::vector<std::pair<int,int> > pos_pair;
-          N_valid_pair = 0;
-          for (int iv=0; iv<N; ++iv) {
-            for (int iv2=0; iv2<N; ++iv2) {
-              if (iv<=iv2)
-                continue;
-
-              if (valid_pair_flag[vs_win[iv]][vs_win[iv2]]) {
-                ++N_valid_pair;
-                pos_pair.push_back(std::make_pair(pos[iv],pos[iv2]));
-              }
-            }
-          }
-
-          if (N_valid_pair==0)
-            return std::vector<int>();
-
-          assert(pos_pair.size()==N_valid_pair);
-          //const int selected = static_cast<int>(random01()*N_valid_pair);
-          //std::cout << " debug " << selected << " " << N_valid_pair << " " << pos_pair.size() << std::endl;
-          //assert(selected<N_valid_pair);
-          std::pair<int,int> tmp = pos_pair[static_cast<int>(random01()*N_valid_pair)];
-          assert(!itime_vertices[tmp.first].is_density_type());
-          assert(!itime_vertices[tmp.second].is_density_type());
-          std::vector<int> r(2);
-          r[0] = tmp.first;
-          r[1] = tmp.second;
-          return r;
+        /**
+         * Probability that pick_up_valid_vertex_pair2 picks up the interacting vertices at pos1 (of type v_pair.first)
+         * and pos2 (of type v_pair.second): O(number of vertices of type v_pair.second)
+         */
+        template<class P>
+        double vertex_pair_removal_prob(const itime_vertex_container& itime_vertices, int pos1, int pos2, double beta, const P& p) {
+          const itime_vertex& v1 = itime_vertices[pos1];
+          const itime_vertex& v2 = itime_vertices[pos2];
+          assert(!v1.is_non_interacting() && !v2.is_non_interacting());
+          const double F = sum_pair_weights(itime_vertices, v2.type(), v1.time(), beta, p);
+          return p.bare_value(mymod(v2.time()-v1.time(), beta))/(itime_vertices.num_interacting(v1.type())*F);
         }
 
+        /**
+         * Pick up a pair of interacting vertices of types v_pair to be removed in a double-vertex update.
+         * The vertex of type v_pair.first is chosen uniformly and its partner of type v_pair.second
+         * with probability proportional to p(tau_2 - tau_1), which mirrors generate_valid_vertex_pair2.
+         * prob is set to the probability of picking up the returned pair.
+         * O(number of vertices of the two types)
+         */
         template<class P, class R>
         std::pair<int,int>
         pick_up_valid_vertex_pair2(const itime_vertex_container& itime_vertices, std::pair<int,int> v_pair,
-                                   double beta, P& p, R& random01, int& N_valid_pair, double& F) {
-
-          std::vector<itime_vertex> v1, v2;
-          std::vector<int> pos_v1, pos_v2;
-          std::vector<double> prob;
-
-          const int Nv = itime_vertices.size();
-          for (int iv=0; iv<Nv; ++iv) {
-            if (itime_vertices[iv].is_non_interacting()) {
-              continue;
-            }
-            if (itime_vertices[iv].type()==v_pair.first) {
-              v1.push_back(itime_vertices[iv]);
-              pos_v1.push_back(iv);
-            } else if (itime_vertices[iv].type()==v_pair.second) {
-              v2.push_back(itime_vertices[iv]);
-              pos_v2.push_back(iv);
-            }
-          }
+                                   double beta, const P& p, R& random01, double& prob) {
+          const std::vector<int>& pos_v1 = itime_vertices.interacting_positions(v_pair.first);
+          const std::vector<int>& pos_v2 = itime_vertices.interacting_positions(v_pair.second);
 
-          N_valid_pair = v1.size()*v2.size();
-          if (N_valid_pair==0) {
+          //pairs of vertices of the same type are not supported
+          if (v_pair.first==v_pair.second || pos_v1.size()==0 || pos_v2.size()==0) {
+            prob = 0.0;
             return std::make_pair(-1,-1);
           }
 
-          assert(v1.size()==pos_v1.size());
-          assert(v2.size()==pos_v2.size());
-          prob.resize(0); prob.reserve(v1.size()*v2.size());
-          for (int iv1=0; iv1<v1.size(); ++iv1) {
-            for (int iv2=0; iv2<v2.size(); ++iv2) {
-              assert(itime_vertices[pos_v2[iv2]].type()==v_pair.second);
-              assert(itime_vertices[pos_v1[iv1]].type()==v_pair.first);
-              prob.push_back(p.bare_value(
-                mymod(itime_vertices[pos_v2[iv2]].time()-itime_vertices[pos_v1[iv1]].time(), beta)
-              ));
-            }
+          const int p1 = pos_v1[static_cast<int>(random01()*pos_v1.size())];
+          const double t1 = itime_vertices[p1].time();
+          std::vector<double> weight(pos_v2.size());
+          double F = 0.0;
+          for (int iv2=0; iv2<pos_v2.size(); ++iv2) {
+            assert(itime_vertices[pos_v2[iv2]].type()==v_pair.second);
+            weight[iv2] = p.bare_value(mymod(itime_vertices[pos_v2[iv2]].time()-t1, beta));
+            F += weight[iv2];
           }
 
-          F = std::accumulate(prob.begin(), prob.end(), 0.0);
-          const int idx = boost::random::discrete_distribution<>(prob.begin(), prob.end())(random01.engine());
-          assert(idx/v2.size()<v1.size());
-          assert(idx%v2.size()<v2.size());
-          return std::make_pair(pos_v1[idx/v2.size()], pos_v2[idx%v2.size()]);
+          double r = random01()*F;
+          int iv2 = 0;
+          while (iv2<pos_v2.size()-1 && r>=weight[iv2]) {
+            r -= weight[iv2];
+            ++iv2;
+          }
+          prob = weight[iv2]/(pos_v1.size()*F);
+          return std::make_pair(p1, pos_v2[iv2]);
         }
 
 
@@ -845,7 +1153,6 @@ public:
           for (int iv = 0; iv < v.size(); ++iv) {
             os << " iv = " << iv;
             os << " type= " << v[iv].type();
-            os << " rank= " << v[iv].rank();
             os << " af_state= " << v[iv].af_state();
             os << " time= " << v[iv].time();
             os << std::endl;
@@ -854,7 +1161,7 @@ public:
 
         template<typename T>
         void load_config(std::ifstream &is, const general_U_matrix<T>& Uijkl, itime_vertex_container &itime_vertices) {
-          itime_vertices.resize(0);
+          itime_vertices.clear();
 
           int Nv;
           is >> Nv;
@@ -866,14 +1173,13 @@ public:
             is >> iv_in >> type >> af_state >> time;
             //std::cout << "type, af_state, time " << type << " " << af_state << " " << time << std::endl;
             const vertex_definition<T>& vdef = Uijkl.get_vertex(type);
-            itime_vertices.push_back(itime_vertex(type, af_state, time, vdef.rank(), vdef.is_density_type()));
+            itime_vertices.push_back(itime_vertex(type, af_state, time, vdef.is_density_type()));
           }
         }
 
         inline
         std::ostream &operator<<(std::ostream &os, const itime_vertex &v) {
           os << " type= " << v.type();
-          os << " rank= " << v.rank();
           os << " af_state= " << v.af_state();
           os << " time= " << v.time();
           return os;
@@ -6,5 +6,14 @@ namespace alps {
     namespace ctint {
         using SimpleRealVectorObservable = alps::accumulators::NoBinningAccumulator<std::vector<double> >;
         using SimpleRealObservable = alps::accumulators::NoBinningAccumulator<double>;
+
+        //Logarithmic binning provides error bars and autocorrelation times at O(log N) memory per element
+        using BinnedRealVectorObservable = alps::accumulators::LogBinningAccumulator<std::vector<double> >;
+        using BinnedRealObservable = alps::accumulators::LogBinningAccumulator<double>;
+
+        //Full binning additionally keeps a fixed number of bins, from which the errors of ratios such as <x s>/<s>
+        //are estimated by jackknife including the correlation between x and the sign
+        using JackknifeRealVectorObservable = alps::accumulators::FullBinningAccumulator<std::vector<double> >;
+        using JackknifeRealObservable = alps::accumulators::FullBinningAccumulator<double>;
     }
 }
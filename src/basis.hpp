@@ -0,0 +1,309 @@
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+#include <boost/multi_array.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <Eigen/Core>
+#include <Eigen/SVD>
+
+#include "legendre.h"
+
+namespace alps {
+    namespace ctint {
+
+        /**
+         * Orthogonal basis in imaginary time used for measuring Sigma G
+         *
+         * The l-th coefficient of a function S(tau) on [0, beta] is c_l = int_0^beta d tau W_l(tau) S(tau),
+         * where W_l are the projectors returned by compute_projectors().
+         * S(i omega_n) (fermionic frequencies) is reconstructed as sum_l Tnl(n, l) c_l.
+         */
+        class BasisTransformer {
+        public:
+            virtual ~BasisTransformer() {}
+
+            virtual std::string name() const = 0;
+
+            //number of basis functions
+            virtual int size() const = 0;
+
+            //val[l][i] = W_l(tau_i) with x[i] = 2 tau_i/beta - 1
+            virtual void compute_projectors(const std::vector<double> &x, boost::multi_array<double, 2> &val) const = 0;
+
+            virtual const Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> &Tnl() const = 0;
+        };
+
+        /**
+         * Legendre polynomials: W_l(tau) = sqrt(2l+1) P_l(x(tau)) (L. Boehnke et al., PRB 84, 075145 (2011))
+         */
+        class LegendreBasis : public BasisTransformer {
+        public:
+            LegendreBasis(int n_matsubara, int n_legendre) : transformer_(n_matsubara, n_legendre) {}
+
+            std::string name() const {
+              return "legendre";
+            }
+
+            int size() const {
+              return transformer_.Nl();
+            }
+
+            void compute_projectors(const std::vector<double> &x, boost::multi_array<double, 2> &val) const {
+              transformer_.compute_legendre(x, val);
+              const std::vector<double> &sqrt_vals = transformer_.get_sqrt_2l_1();
+              const std::size_t stride = val.strides()[0];
+              for (int l = 1; l < size(); ++l) {
+                double *val_l = val.origin() + l * stride;
+                for (int i = 0; i < x.size(); ++i) {
+                  val_l[i] *= sqrt_vals[l];
+                }
+              }
+            }
+
+            const Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> &Tnl() const {
+              return transformer_.Tnl();
+            }
+
+        private:
+            LegendreTransformer transformer_;
+        };
+
+        /**
+         * Gauss-Legendre quadrature of order n on [a, b]
+         */
+        inline void gauss_legendre(int n, double a, double b, std::vector<double> &nodes, std::vector<double> &weights) {
+          nodes.resize(n);
+          weights.resize(n);
+          for (int i = 0; i < n; ++i) {
+            //Newton iteration from the Chebyshev approximation of the i-th root
+            double x = std::cos(M_PI * (i + 0.75) / (n + 0.5)), dp = 0.0;
+            for (int iter = 0; iter < 100; ++iter) {
+              double p0 = 1.0, p1 = x;
+              for (int k = 2; k <= n; ++k) {
+                const double p2 = ((2 * k - 1) * x * p1 - (k - 1) * p0) / k;
+                p0 = p1;
+                p1 = p2;
+              }
+              dp = n * (x * p1 - p0) / (x * x - 1);
+              const double dx = p1 / dp;
+              x -= dx;
+              if (std::abs(dx) < 1e-15) {
+                break;
+              }
+            }
+            nodes[n - 1 - i] = 0.5 * (b - a) * x + 0.5 * (b + a);
+            weights[n - 1 - i] = (b - a) / ((1 - x * x) * dp * dp);
+          }
+        }
+
+        /**
+         * Intermediate representation (IR) basis for fermions
+         * (H. Shinaoka et al., PRB 96, 035147 (2017))
+         *
+         * The basis functions u_l(x) are the left singular functions of the kernel
+         *   K(x, y) = exp(-Lambda y (x+1)/2) / (1 + exp(-Lambda y)),  x = 2 tau/beta - 1,  y = beta omega/Lambda,
+         * which is discretized by composite Gauss-Legendre quadratures refined geometrically towards
+         * the edges of x and y = 0, and decomposed with a dense SVD.
+         * Basis functions with s_l/s_0 > sv_cutoff are kept; their number grows as O(log Lambda).
+         * In double precision, the basis functions lose accuracy for sv_cutoff below about 1e-10.
+         *
+         * The projectors W_l(tau) = sqrt(2/beta) u_l(x(tau)) are orthonormal on [0, beta].
+         * They are tabulated on a fine grid and evaluated by cubic interpolation.
+         * Tnl(n, l) = int_0^beta d tau exp(i omega_n tau) W_l(tau) is evaluated exactly from the right singular functions.
+         */
+        class IRBasis : public BasisTransformer {
+        public:
+            IRBasis(int n_matsubara, double beta, double Lambda, double sv_cutoff, int n_gauss = 16, int n_fine = 128)
+              : beta_(beta), n_fine_(n_fine) {
+              if (Lambda <= 0.0 || sv_cutoff <= 0.0 || beta <= 0.0) {
+                throw std::invalid_argument("IRBasis: beta, Lambda and sv_cutoff must be positive");
+              }
+              const int n_refine = static_cast<int>(std::ceil(std::log2(Lambda))) + 4;
+
+              //segments of x refined towards -1 and 1, segments of y refined towards 0
+              std::vector<double> x_half, y_half;
+              x_half.push_back(0.0);
+              for (int k = 1; k <= n_refine; ++k) {
+                x_half.push_back(1 - std::pow(0.5, k));
+              }
+              x_half.push_back(1.0);
+              y_half.push_back(0.0);
+              for (int k = n_refine; k >= 0; --k) {
+                y_half.push_back(std::pow(0.5, k));
+              }
+              section_edges_ = symmetrize(x_half);
+              const std::vector<double> y_edges = symmetrize(y_half);
+
+              std::vector<double> x_nodes, x_weights, y_nodes, y_weights;
+              composite_gauss_legendre(section_edges_, n_gauss, x_nodes, x_weights);
+              composite_gauss_legendre(y_edges, n_gauss, y_nodes, y_weights);
+
+              const int nx = x_nodes.size(), ny = y_nodes.size();
+              Eigen::MatrixXd A(nx, ny);
+              for (int i = 0; i < nx; ++i) {
+                for (int j = 0; j < ny; ++j) {
+                  A(i, j) = std::sqrt(x_weights[i]) * kernel(Lambda, x_nodes[i], y_nodes[j]) * std::sqrt(y_weights[j]);
+                }
+              }
+              Eigen::BDCSVD<Eigen::MatrixXd> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
+              const Eigen::VectorXd &sv = svd.singularValues();
+              int n_basis = 0;
+              while (n_basis < sv.size() && sv[n_basis] > sv_cutoff * sv[0]) {
+                ++n_basis;
+              }
+              singular_values_.assign(sv.data(), sv.data() + n_basis);
+
+              //v_l(y_j) sqrt(w_j), with the sign convention u_l(1) > 0
+              Eigen::MatrixXd V = svd.matrixV().leftCols(n_basis);
+              for (int l = 0; l < n_basis; ++l) {
+                double u_at_1 = 0.0;
+                for (int j = 0; j < ny; ++j) {
+                  u_at_1 += kernel(Lambda, 1.0, y_nodes[j]) * std::sqrt(y_weights[j]) * V(j, l);
+                }
+                if (u_at_1 < 0) {
+                  V.col(l) *= -1;
+                }
+              }
+
+              //W_l on the fine grid: u_l(x) = sum_j K(x, y_j) sqrt(w_j) V_{jl} / s_l
+              const int n_sections = section_edges_.size() - 1;
+              fine_values_.resize(n_sections * (n_fine + 1), n_basis);
+              Eigen::RowVectorXd K_row(ny);
+              for (int s = 0; s < n_sections; ++s) {
+                for (int i = 0; i <= n_fine; ++i) {
+                  const double x = section_edges_[s] + (section_edges_[s + 1] - section_edges_[s]) * i / n_fine;
+                  for (int j = 0; j < ny; ++j) {
+                    K_row[j] = kernel(Lambda, x, y_nodes[j]) * std::sqrt(y_weights[j]);
+                  }
+                  fine_values_.row(s * (n_fine + 1) + i) = K_row * V;
+                }
+              }
+              for (int l = 0; l < n_basis; ++l) {
+                fine_values_.col(l) *= std::sqrt(2 / beta) / singular_values_[l];
+              }
+
+              //Tnl = sqrt(2/beta) / s_l sum_j sqrt(w_j) V_{jl} / (Lambda y_j/beta - i omega_n)
+              Tnl_.resize(n_matsubara, n_basis);
+              Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> kernel_w(n_matsubara, ny);
+              for (int n = 0; n < n_matsubara; ++n) {
+                const double omega_n = (2 * n + 1) * M_PI / beta;
+                for (int j = 0; j < ny; ++j) {
+                  kernel_w(n, j) = std::sqrt(y_weights[j]) / std::complex<double>(Lambda * y_nodes[j] / beta, -omega_n);
+                }
+              }
+              Tnl_ = kernel_w * V.cast<std::complex<double> >();
+              for (int l = 0; l < n_basis; ++l) {
+                Tnl_.col(l) *= std::sqrt(2 / beta) / singular_values_[l];
+              }
+            }
+
+            std::string name() const {
+              return "ir";
+            }
+
+            int size() const {
+              return singular_values_.size();
+            }
+
+            const std::vector<double> &singular_values() const {
+              return singular_values_;
+            }
+
+            void compute_projectors(const std::vector<double> &x, boost::multi_array<double, 2> &val) const {
+              assert(val.shape()[0] >= size() && val.shape()[1] >= x.size() && val.strides()[1] == 1);
+              const std::size_t stride = val.strides()[0];
+              const int n_sections = section_edges_.size() - 1;
+              for (int i = 0; i < x.size(); ++i) {
+                const int s = std::min<int>(
+                  std::max<int>(std::upper_bound(section_edges_.begin(), section_edges_.end(), x[i]) - section_edges_.begin() - 1, 0),
+                  n_sections - 1);
+                const double t = (x[i] - section_edges_[s]) / (section_edges_[s + 1] - section_edges_[s]) * n_fine_;
+                const int i0 = std::min(std::max(static_cast<int>(std::floor(t)) - 1, 0), n_fine_ - 3);
+                //weights of four-point Lagrange interpolation on i0, ..., i0+3
+                double w[4];
+                for (int k = 0; k < 4; ++k) {
+                  w[k] = 1.0;
+                  for (int k2 = 0; k2 < 4; ++k2) {
+                    if (k2 != k) {
+                      w[k] *= (t - (i0 + k2)) / static_cast<double>(k - k2);
+                    }
+                  }
+                }
+                const int row = s * (n_fine_ + 1) + i0;
+                for (int l = 0; l < size(); ++l) {
+                  val.origin()[l * stride + i] =
+                    w[0] * fine_values_(row, l) + w[1] * fine_values_(row + 1, l) +
+                    w[2] * fine_values_(row + 2, l) + w[3] * fine_values_(row + 3, l);
+                }
+              }
+            }
+
+            const Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> &Tnl() const {
+              return Tnl_;
+            }
+
+        private:
+            static double kernel(double Lambda, double x, double y) {
+              //numerically stable for both signs of y
+              if (y >= 0) {
+                return std::exp(-Lambda * y * (x + 1) / 2) / (1 + std::exp(-Lambda * y));
+              } else {
+                return std::exp(Lambda * y * (1 - x) / 2) / (1 + std::exp(Lambda * y));
+              }
+            }
+
+            static std::vector<double> symmetrize(const std::vector<double> &half) {
+              std::vector<double> edges;
+              for (int i = half.size() - 1; i > 0; --i) {
+                edges.push_back(-half[i]);
+              }
+              edges.insert(edges.end(), half.begin(), half.end());
+              return edges;
+            }
+
+            static void composite_gauss_legendre(const std::vector<double> &edges, int n,
+                                                 std::vector<double> &nodes, std::vector<double> &weights) {
+              nodes.clear();
+              weights.clear();
+              std::vector<double> nodes_s, weights_s;
+              for (int s = 0; s < edges.size() - 1; ++s) {
+                gauss_legendre(n, edges[s], edges[s + 1], nodes_s, weights_s);
+                nodes.insert(nodes.end(), nodes_s.begin(), nodes_s.end());
+                weights.insert(weights.end(), weights_s.begin(), weights_s.end());
+              }
+            }
+
+            const double beta_;
+            const int n_fine_;
+            std::vector<double> section_edges_, singular_values_;
+            Eigen::MatrixXd fine_values_;//(point on the fine grid, l)
+            Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> Tnl_;
+        };
+
+        /**
+         * Basis for G1 chosen by the parameter "G1.basis"
+         */
+        template<class P>
+        boost::shared_ptr<BasisTransformer> make_G1_basis(const P &parms) {
+          const std::string basis = parms["G1.basis"].template as<std::string>();
+          if (basis == "legendre") {
+            return boost::shared_ptr<BasisTransformer>(
+              new LegendreBasis(parms["G1.n_matsubara"].template as<int>(), parms["G1.n_legendre"].template as<int>()));
+          } else if (basis == "ir") {
+            return boost::shared_ptr<BasisTransformer>(
+              new IRBasis(parms["G1.n_matsubara"].template as<int>(), parms["model.beta"].template as<double>(),
+                          parms["G1.ir_lambda"].template as<double>(), parms["G1.ir_sv_cutoff"].template as<double>()));
+          } else {
+            throw std::runtime_error("Unknown G1.basis: " + basis);
+          }
+        }
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include <Eigen/Core>
+
+#include <alps/params.hpp>
+
+#include "green_function.h"
+
+namespace alps {
+    namespace ctint {
+
+        /**
+         * Approximate joint diagonalization of real symmetric matrices by Jacobi rotations
+         * (J.-F. Cardoso and A. Souloumiac, SIAM J. Mat. Anal. Appl. 17, 161 (1996), real case).
+         *
+         * Returns an orthogonal V that minimizes sum_k sum_{a!=b} |(V^T mats[k] V)_{ab}|^2.
+         */
+        inline Eigen::MatrixXd joint_diagonalizer(std::vector<Eigen::MatrixXd> mats, double tol = 1e-12, int max_sweeps = 100) {
+          if (mats.size() == 0) {
+            throw std::invalid_argument("No matrix to be diagonalized.");
+          }
+          const int N = mats[0].rows();
+          for (const auto& A : mats) {
+            if (A.rows() != N || A.cols() != N) {
+              throw std::invalid_argument("Matrices to be jointly diagonalized must be square and of the same size.");
+            }
+          }
+
+          Eigen::MatrixXd V = Eigen::MatrixXd::Identity(N, N);
+          for (int sweep = 0; sweep < max_sweeps; ++sweep) {
+            bool rotated = false;
+            for (int p = 0; p < N - 1; ++p) {
+              for (int q = p + 1; q < N; ++q) {
+                double g11 = 0.0, g12 = 0.0, g22 = 0.0;
+                for (const auto& A : mats) {
+                  const double h0 = A(p, p) - A(q, q), h1 = A(p, q) + A(q, p);
+                  g11 += h0 * h0;
+                  g12 += h0 * h1;
+                  g22 += h1 * h1;
+                }
+                const double ton = g11 - g22, toff = 2 * g12;
+                const double theta = 0.5 * std::atan2(toff, ton + std::sqrt(ton * ton + toff * toff));
+                const double c = std::cos(theta), s = std::sin(theta);
+                if (std::abs(s) < tol) {
+                  continue;
+                }
+                rotated = true;
+
+                for (auto& A : mats) {
+                  for (int i = 0; i < N; ++i) {
+                    const double rp = A(p, i), rq = A(q, i);
+                    A(p, i) = c * rp + s * rq;
+                    A(q, i) = -s * rp + c * rq;
+                  }
+                  for (int i = 0; i < N; ++i) {
+                    const double cp = A(i, p), cq = A(i, q);
+                    A(i, p) = c * cp + s * cq;
+                    A(i, q) = -s * cp + c * cq;
+                  }
+                }
+                for (int i = 0; i < N; ++i) {
+                  const double vp = V(i, p), vq = V(i, q);
+                  V(i, p) = c * vp + s * vq;
+                  V(i, q) = -s * vp + c * vq;
+                }
+              }
+            }
+            if (!rotated) {
+              break;
+            }
+          }
+          return V;
+        }
+
+        /**
+         * sum_k sum_{a!=b} |(V^T mats[k] V)_{ab}|^2
+         */
+        inline double off_diagonal_weight(const std::vector<Eigen::MatrixXd>& mats, const Eigen::MatrixXd& V) {
+          double weight = 0.0;
+          for (const auto& A : mats) {
+            const Eigen::MatrixXd A_rot = V.transpose() * A * V;
+            weight += A_rot.squaredNorm() - A_rot.diagonal().squaredNorm();
+          }
+          return weight;
+        }
+
+        /**
+         * Real symmetric part of G0_{ij}(tau) of a given flavor on (at most) max_points points of the tau grid
+         */
+        template<typename T>
+        std::vector<Eigen::MatrixXd> sample_G0_matrices(const green_function<T>& g0, int flavor, int max_points = 100) {
+          const int n_site = g0.num_sites();
+          const int n_tau = g0.num_tau_points();
+          const int stride = std::max(1, n_tau / max_points);
+          std::vector<Eigen::MatrixXd> mats;
+          for (int itau = 0; itau < n_tau; itau += stride) {
+            Eigen::MatrixXd A(n_site, n_site);
+            for (int i = 0; i < n_site; ++i) {
+              for (int j = 0; j < n_site; ++j) {
+                A(i, j) = 0.5 * (std::real(g0.interpolate(flavor, i, j, g0.tau(itau)))
+                                 + std::real(g0.interpolate(flavor, j, i, g0.tau(itau))));
+              }
+            }
+            mats.push_back(A);
+          }
+          return mats;
+        }
+
+        /**
+         * Single-particle basis rotation chosen by the parameter "model.basis_rotation"
+         *
+         * Returns V[flavor] defining the basis d_a = sum_i V[flavor](i,a) c_i.
+         * When the rotation is enabled, V[flavor] jointly diagonalizes G0_{ij}(tau) on the tau grid,
+         * which reduces the weight of the off-diagonal elements of G0 responsible for the sign problem.
+         * Otherwise, V[flavor] is the identity.
+         */
+        inline std::vector<Eigen::MatrixXd> make_basis_rotation(const alps::params &parms) {
+          const int n_site = parms["model.sites"];
+          const int n_flavors = parms["model.spins"];
+          std::vector<Eigen::MatrixXd> V(n_flavors, Eigen::MatrixXd::Identity(n_site, n_site));
+          if (!parms["model.basis_rotation"].as<bool>()) {
+            return V;
+          }
+
+          green_function<std::complex<double> > g0;
+          g0.read_itime_data(parms["model.G0_tau_file"], parms["model.beta"], n_flavors, n_site);
+          for (int flavor = 0; flavor < n_flavors; ++flavor) {
+            V[flavor] = joint_diagonalizer(sample_G0_matrices(g0, flavor));
+          }
+          return V;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <cassert>
+
+namespace alps {
+    namespace ctint {
+
+        /**
+         * Online logarithmic binning analysis of a scalar time series
+         *
+         * Level l holds the means of consecutive bins of 2^l samples.
+         * The error of the mean is estimated at the highest level which has at least min_bins bins.
+         * The integrated autocorrelation time (in units of samples) is defined as tau_int = sum_{k>=1} rho(k),
+         * where rho(k) is the normalized autocorrelation function, so that tau_int = 0 for uncorrelated samples and
+         * err^2 = (1 + 2 tau_int) err_0^2. It is estimated as tau_int = (err_l^2/err_0^2 - 1)/2.
+         * For an AR(1) process x_{i+1} = rho x_i + noise, tau_int = rho/(1-rho).
+         */
+        class BinningAnalysis {
+        public:
+            BinningAnalysis(int max_levels = 32, int min_bins = 32)
+              : min_bins_(min_bins),
+                sum_(max_levels, 0.0),
+                sum2_(max_levels, 0.0),
+                count_(max_levels, 0),
+                pending_(max_levels, 0.0),
+                has_pending_(max_levels, false) {}
+
+            void add_sample(double x) {
+              double value = x;
+              for (int l = 0; l < sum_.size(); ++l) {
+                sum_[l] += value;
+                sum2_[l] += value * value;
+                ++count_[l];
+                if (!has_pending_[l]) {
+                  pending_[l] = value;
+                  has_pending_[l] = true;
+                  return;
+                }
+                value = 0.5 * (pending_[l] + value);
+                has_pending_[l] = false;
+              }
+            }
+
+            long count() const {
+              return count_[0];
+            }
+
+            double mean() const {
+              return count_[0] > 0 ? sum_[0] / count_[0] : 0.0;
+            }
+
+            /**
+             * Error of the mean estimated from the bins at the given level
+             */
+            double error(int level) const {
+              assert(level >= 0 && level < sum_.size());
+              const long n = count_[level];
+              if (n < 2) {
+                return 0.0;
+              }
+              const double mean = sum_[level] / n;
+              const double var = std::max(sum2_[level] / n - mean * mean, 0.0) * n / (n - 1.0);
+              return std::sqrt(var / n);
+            }
+
+            /**
+             * The highest level with at least min_bins bins
+             */
+            int converged_level() const {
+              int level = 0;
+              while (level + 1 < sum_.size() && count_[level + 1] >= min_bins_) {
+                ++level;
+              }
+              return level;
+            }
+
+            double error() const {
+              return error(converged_level());
+            }
+
+            double tau_int() const {
+              const double err0 = error(0);
+              if (err0 == 0.0) {
+                return 0.0;
+              }
+              const double ratio = error() / err0;
+              return std::max(0.5 * (ratio * ratio - 1.0), 0.0);
+            }
+
+            /**
+             * Whether the error estimate can be trusted: the converged level is at least min_level
+             * (min_bins bins of 2^min_level samples or more) and there are at least 100 tau_int samples
+             */
+            bool is_reliable(int min_level) const {
+              return converged_level() >= min_level && count() >= 100.0 * tau_int();
+            }
+
+            /**
+             * Number of statistically independent samples
+             */
+            double effective_count() const {
+              return count() / (1.0 + 2.0 * tau_int());
+            }
+
+        private:
+            int min_bins_;
+            std::vector<double> sum_, sum2_;
+            std::vector<long> count_;
+            std::vector<double> pending_;
+            std::vector<bool> has_pending_;
+        };
+    }
+}
@@ -0,0 +1,23 @@
+#include <iostream>
+
+#include "U_matrix.h"
+
+/**
+ * Convert a U-matrix file in the text format into the binary format.
+ * The binary file can be passed to the solver through model.U_matrix_file in the same way as a text file.
+ */
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " input_text_file output_binary_file" << std::endl;
+    return 1;
+  }
+  try {
+    const std::vector<double> packed = alps::ctint::U_matrix_file::read_text(argv[1]);
+    alps::ctint::U_matrix_file::write_binary(argv[2], packed);
+    std::cout << "Converted " << static_cast<size_t>(packed[0]) << " vertices into " << argv[2] << std::endl;
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <limits>
+#include <stdexcept>
+
+namespace alps {
+    namespace ctint {
+
+        /**
+         * Online detector of the end of the equilibration phase.
+         *
+         * Samples of several time series (e.g. the perturbation order of each flavor and the sign) are accumulated
+         * into batch means. The number of stored batches is bounded: when the buffer is full, neighbouring batches
+         * are merged and the batch size is doubled, so each check costs O(max_batches) irrespective of
+         * the length of the thermalization phase.
+         *
+         * A series is regarded as stationary when
+         *  1) the MSER truncation point (White, Simulation 69, 323 (1997)) lies in the first half of the stored
+         *     history, and
+         *  2) the means of the two halves of the truncated history agree within "tolerance" standard errors.
+         * The chain is equilibrated when all series are stationary.
+         */
+        class EquilibrationDetector {
+        public:
+            EquilibrationDetector(int n_series, int min_samples, double tolerance, int max_batches = 256)
+              : n_series_(n_series),
+                min_samples_(min_samples),
+                tolerance_(tolerance),
+                max_batches_(max_batches),
+                batch_size_(1),
+                num_samples_(0),
+                num_in_current_batch_(0),
+                current_batch_(n_series, 0.0),
+                batches_(n_series) {
+              if (n_series <= 0) {
+                throw std::invalid_argument("EquilibrationDetector: n_series must be positive");
+              }
+              if (max_batches < 8 || max_batches % 2 != 0) {
+                throw std::invalid_argument("EquilibrationDetector: max_batches must be an even number larger than 7");
+              }
+            }
+
+            void add_sample(const std::vector<double> &sample) {
+              if (sample.size() != static_cast<std::size_t>(n_series_)) {
+                throw std::invalid_argument("EquilibrationDetector: the size of sample is wrong");
+              }
+              for (int is = 0; is < n_series_; ++is) {
+                current_batch_[is] += sample[is];
+              }
+              ++num_samples_;
+              ++num_in_current_batch_;
+
+              if (num_in_current_batch_ < batch_size_) {
+                return;
+              }
+              for (int is = 0; is < n_series_; ++is) {
+                batches_[is].push_back(current_batch_[is] / batch_size_);
+                current_batch_[is] = 0.0;
+              }
+              num_in_current_batch_ = 0;
+
+              if (batches_[0].size() == static_cast<std::size_t>(max_batches_)) {
+                for (int is = 0; is < n_series_; ++is) {
+                  for (int ib = 0; ib < max_batches_ / 2; ++ib) {
+                    batches_[is][ib] = 0.5 * (batches_[is][2 * ib] + batches_[is][2 * ib + 1]);
+                  }
+                  batches_[is].resize(max_batches_ / 2);
+                }
+                batch_size_ *= 2;
+              }
+            }
+
+            /**
+             * Return true if all the series look stationary.
+             */
+            bool is_stationary() const {
+              if (num_samples_ < min_samples_ || batches_[0].size() < 8) {
+                return false;
+              }
+              for (int is = 0; is < n_series_; ++is) {
+                if (!is_stationary(batches_[is])) {
+                  return false;
+                }
+              }
+              return true;
+            }
+
+            long num_samples() const {
+              return num_samples_;
+            }
+
+        private:
+            bool is_stationary(const std::vector<double> &y) const {
+              const int n = y.size();
+
+              //MSER statistic computed from the tail with suffix sums
+              std::vector<double> suffix_sum(n + 1, 0.0), suffix_sum2(n + 1, 0.0);
+              for (int i = n - 1; i >= 0; --i) {
+                suffix_sum[i] = suffix_sum[i + 1] + y[i];
+                suffix_sum2[i] = suffix_sum2[i + 1] + y[i] * y[i];
+              }
+              int d_opt = 0;
+              double mser_min = std::numeric_limits<double>::max();
+              for (int d = 0; d < n - 4; ++d) {
+                const double m = n - d;
+                const double var = std::max(suffix_sum2[d] / m - (suffix_sum[d] / m) * (suffix_sum[d] / m), 0.0);
+                const double mser = var / m;
+                if (mser < mser_min) {
+                  mser_min = mser;
+                  d_opt = d;
+                }
+              }
+              if (2 * d_opt > n) {
+                return false;
+              }
+
+              //compare the two halves of the truncated history
+              const int n_half = (n - d_opt) / 2;
+              const int begin1 = n - 2 * n_half, begin2 = n - n_half;
+              double mean1, var1, mean2, var2;
+              mean_and_variance(y, begin1, begin2, mean1, var1);
+              mean_and_variance(y, begin2, n, mean2, var2);
+              const double std_err = std::sqrt((var1 + var2) / n_half);
+              return std::abs(mean1 - mean2) <= tolerance_ * std_err + 1e-12 * std::max(std::abs(mean1), 1.0);
+            }
+
+            static void mean_and_variance(const std::vector<double> &y, int begin, int end, double &mean, double &var) {
+              const int n = end - begin;
+              mean = 0.0;
+              for (int i = begin; i < end; ++i) {
+                mean += y[i];
+              }
+              mean /= n;
+              var = 0.0;
+              for (int i = begin; i < end; ++i) {
+                var += (y[i] - mean) * (y[i] - mean);
+              }
+              var /= (n - 1);
+            }
+
+            const int n_series_;
+            const long min_samples_;
+            const double tolerance_;
+            const int max_batches_;
+            long batch_size_, num_samples_, num_in_current_batch_;
+            std::vector<double> current_batch_;
+            std::vector<std::vector<double> > batches_;
+        };
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <stdexcept>
+
+namespace alps {
+    namespace ctint {
+
+        /**
+         * In-place radix-2 FFT: data[k] <- sum_m data[m] exp(sign * 2 pi i k m / N)
+         *
+         * N = data.size() must be a power of two. sign must be +1 or -1.
+         */
+        inline void fft_radix2(std::vector<std::complex<double> > &data, int sign) {
+          const std::size_t N = data.size();
+          if (N == 0 || (N & (N - 1)) != 0) {
+            throw std::invalid_argument("fft_radix2: the size of data must be a power of two");
+          }
+
+          //bit reversal permutation
+          for (std::size_t i = 1, j = 0; i < N; ++i) {
+            std::size_t bit = N >> 1;
+            for (; j & bit; bit >>= 1) {
+              j ^= bit;
+            }
+            j ^= bit;
+            if (i < j) {
+              std::swap(data[i], data[j]);
+            }
+          }
+
+          //butterflies with a table of twiddle factors (accurate to machine precision)
+          std::vector<std::complex<double> > twiddle(N / 2);
+          for (std::size_t k = 0; k < N / 2; ++k) {
+            twiddle[k] = std::polar(1.0, sign * 2 * M_PI * k / N);
+          }
+          for (std::size_t len = 2; len <= N; len <<= 1) {
+            const std::size_t stride = N / len;
+            for (std::size_t i = 0; i < N; i += len) {
+              for (std::size_t k = 0; k < len / 2; ++k) {
+                const std::complex<double> u = data[i + k];
+                const std::complex<double> v = data[i + k + len / 2] * twiddle[k * stride];
+                data[i + k] = u + v;
+                data[i + k + len / 2] = u - v;
+              }
+            }
+          }
+        }
+    }
+}
@@ -58,7 +58,6 @@ namespace alps {
 
               // Read data
               int flavor_tmp, itmp, itmp2, itmp3;
-              std::vector<double> y_re(n_tau), y_im(n_tau);
               double re, im;
               int line = 1 + n_tau;
               for (spin_t flavor=0; flavor<n_flavor; ++flavor) {
@@ -88,26 +87,12 @@ namespace alps {
                            line).str().c_str());
                       }
                       data_[flavor][site1][site2][itau] = mycast<T>(std::complex<double>(re, im));
-                      y_re[itau] = std::real(data_[flavor][site1][site2][itau]);
-                      y_im[itau] = std::imag(data_[flavor][site1][site2][itau]);
                       ++line;
                     }
-
-                    // cublic spline
-                    splines_re_[flavor][site1][site2].set_points(tau_, y_re);
-                    splines_im_[flavor][site1][site2].set_points(tau_, y_im);
-                    for (int t=0; t < n_tau-1; ++t) {
-                      for (int p=0; p < 4; ++p) {
-                        spline_coeff_[flavor][site1][site2][t][p] =
-                          std::complex<double>(
-                            splines_re_[flavor][site1][site2].get_coeff(t,p),
-                            splines_im_[flavor][site1][site2].get_coeff(t,p)
-                          );
-                      }
-                    }
                   }
                 }
               }
+              build_splines();
 
               for (int flavor=0; flavor < num_flavors(); ++flavor) {
                 for (int site=0; site<num_sites(); ++site) {
@@ -127,33 +112,24 @@ namespace alps {
              */
             T operator()(const annihilator &c, const creator &cdagger) const {
               assert(c.flavor() == cdagger.flavor());
+              return evaluate_pair(c.flavor(), c.s(), cdagger.s(), c.t().time(), c.t().small_index(),
+                                   cdagger.t().time(), cdagger.t().small_index());
+            }
 
-              const int flavor = c.flavor();
-
-              const int site1 = c.s(), site2 = cdagger.s();
-              double dt = c.t().time() - cdagger.t().time();
-
-              if (dt == 0.0) {
-                if (c.t().small_index() > cdagger.t().small_index()) { //G(+delta)
-                  return interpolate(flavor, site1, site2, 0.0);
-                } else { //G(-delta)
-                  return -interpolate(flavor, site1, site2, beta_);
-                }
-              } else {
-                double sign = 1.0;
-
-                while (dt >= beta_) {
-                  dt -= beta_;
-                  sign *= -1.0;
-                }
-                while (dt < 0.0) {
-                  dt += beta_;
-                  sign *= -1.0;
-                }
-
-                assert(dt >= 0 && dt <= beta_);
-
-                return sign * interpolate(flavor, site1, site2, dt);
+            /*
+             * Batched version of operator()(annihilator, creator) for num annihilators and a single creator.
+             * The i-th annihilator has the flavor of cdagger, site sites[i], time times[i] and small index small_indices[i]
+             * (structure of arrays, as stored in InvAMatrix). No operator object is constructed.
+             */
+            template<typename S>
+            void interpolate_annihilators(const creator &cdagger, const itime_t *times, const int *small_indices,
+                                          const site_t *sites, int num, S *values) const {
+              const int flavor = cdagger.flavor();
+              const int site2 = cdagger.s();
+              const double time2 = cdagger.t().time();
+              const int small_index2 = cdagger.t().small_index();
+              for (int i = 0; i < num; ++i) {
+                values[i] = mycast<S>(evaluate_pair(flavor, sites[i], site2, times[i], small_indices[i], time2, small_index2));
               }
             }
 
@@ -217,8 +193,119 @@ namespace alps {
              * if delta_t = n beta (n = 0, +/- 1, ...), it assume delta_t = +0
              */
             T operator()(double delta_t, int flavor, int site1, int site2) const {
-              double dt = delta_t;
-              T sign = 1.0;
+              double dt, sign;
+              int idx;
+              double h;
+              locate(delta_t, dt, sign, idx, h);
+              return mycast<T>(sign * evaluate_segment(flavor, site1, site2, idx, h));
+            }
+
+            /*
+             * Batched versions of operator()(delta_t, flavor, site1, site2):
+             * interpolate_row computes G(delta_t) for (site1, site2=0, ..., nsite-1),
+             * interpolate_column computes G(delta_t) for (site1=0, ..., nsite-1, site2).
+             * The reduction of delta_t to [0, beta] and the search of the spline segment are shared by all the sites.
+             */
+            template<typename S>
+            void interpolate_row(double delta_t, int flavor, int site1, S *values) const {
+              double dt, sign;
+              int idx;
+              double h;
+              locate(delta_t, dt, sign, idx, h);
+              for (int site2 = 0; site2 < num_sites(); ++site2) {
+                values[site2] = mycast<S>(sign * evaluate_segment(flavor, site1, site2, idx, h));
+              }
+            }
+
+            template<typename S>
+            void interpolate_column(double delta_t, int flavor, int site2, S *values) const {
+              double dt, sign;
+              int idx;
+              double h;
+              locate(delta_t, dt, sign, idx, h);
+              for (int site1 = 0; site1 < num_sites(); ++site1) {
+                values[site1] = mycast<S>(sign * evaluate_segment(flavor, site1, site2, idx, h));
+              }
+            }
+
+            /**
+             * Transform G0 into the basis d_a = sum_i V[flavor](i,a) c_i for each flavor (V[flavor] is orthogonal):
+             * G0_{ab}(tau) -> sum_{ij} V(i,a) G0_{ij}(tau) V(j,b)
+             */
+            void rotate_basis(const std::vector<Eigen::MatrixXd>& V) {
+              const int n_site = num_sites();
+              boost::multi_array<T,4> data_org(data_);
+              for (int flavor=0; flavor < num_flavors(); ++flavor) {
+                for (int itau=0; itau < ntau_; ++itau) {
+                  for (int a=0; a < n_site; ++a) {
+                    for (int b=0; b < n_site; ++b) {
+                      T sum = 0.0;
+                      for (int i=0; i < n_site; ++i) {
+                        for (int j=0; j < n_site; ++j) {
+                          sum += V[flavor](i,a) * data_org[flavor][i][j][itau] * V[flavor](j,b);
+                        }
+                      }
+                      data_[flavor][a][b][itau] = sum;
+                    }
+                  }
+                }
+              }
+              build_splines();
+            }
+
+            bool is_zero(int flavor, int site1, int site2, double eps) const {
+              return std::abs(interpolate(flavor, site1, site2, beta_* 1E-5)) < eps &&
+                     std::abs(interpolate(flavor, site1, site2, beta_ * (1 - 1E-5))) < eps;
+            }
+
+        private:
+            // cubic splines through data_
+            void build_splines() {
+              std::vector<double> y_re(ntau_), y_im(ntau_);
+              for (int flavor=0; flavor < num_flavors(); ++flavor) {
+                for (int site1=0; site1 < num_sites(); ++site1) {
+                  for (int site2=0; site2 < num_sites(); ++site2) {
+                    for (int itau=0; itau < ntau_; ++itau) {
+                      y_re[itau] = std::real(data_[flavor][site1][site2][itau]);
+                      y_im[itau] = std::imag(data_[flavor][site1][site2][itau]);
+                    }
+                    splines_re_[flavor][site1][site2].set_points(tau_, y_re);
+                    splines_im_[flavor][site1][site2].set_points(tau_, y_im);
+                    for (int t=0; t < ntau_-1; ++t) {
+                      for (int p=0; p < 4; ++p) {
+                        spline_coeff_[flavor][site1][site2][t][p] =
+                          std::complex<double>(
+                            splines_re_[flavor][site1][site2].get_coeff(t,p),
+                            splines_im_[flavor][site1][site2].get_coeff(t,p)
+                          );
+                      }
+                    }
+                  }
+                }
+              }
+            }
+
+            //G0 between c at (time1, small_index1) and c^dagger at (time2, small_index2)
+            T evaluate_pair(int flavor, int site1, int site2, double time1, int small_index1, double time2, int small_index2) const {
+              if (time1 == time2) {
+                if (small_index1 > small_index2) { //G(+delta)
+                  return interpolate(flavor, site1, site2, 0.0);
+                } else { //G(-delta)
+                  return -interpolate(flavor, site1, site2, beta_);
+                }
+              }
+
+              double dt, sign;
+              int idx;
+              double h;
+              locate(time1 - time2, dt, sign, idx, h);
+              return mycast<T>(sign * evaluate_segment(flavor, site1, site2, idx, h));
+            }
+
+            //reduce delta_t to dt in [0, beta] (dt = +0 if delta_t = n beta) and find its spline segment
+            void locate(double delta_t, double &dt, double &sign, int &idx, double &h) const {
+              dt = delta_t;
+              sign = 1.0;
               while (dt >= beta_) {
                 dt -= beta_;
                 sign *= -1.0;
@@ -227,18 +314,20 @@ namespace alps {
                 dt += beta_;
                 sign *= -1.0;
               }
-
               if (dt == 0.0) dt += 1E-8;
 
-              return sign * interpolate(flavor, site1, site2, dt);
+              idx = static_cast<int>(dt * inv_dtau_);
+              if (idx == ntau_-1) {
+                idx = ntau_-2;
+              }
+              h = dt - idx * dtau_;
             }
 
-            bool is_zero(int flavor, int site1, int site2, double eps) const {
-              return std::abs(interpolate(flavor, site1, site2, beta_* 1E-5)) < eps &&
-                     std::abs(interpolate(flavor, site1, site2, beta_ * (1 - 1E-5))) < eps;
+            std::complex<double> evaluate_segment(int flavor, int site1, int site2, int idx, double h) const {
+              const std::complex<double> *coeff = &spline_coeff_[flavor][site1][site2][idx][0];
+              return ((coeff[3] * h + coeff[2]) * h + coeff[1]) * h + coeff[0];
             }
 
-        private:
             // flavor, site, site, tau
             boost::multi_array<T,4> data_;
             double dtau_, inv_dtau_;
@@ -326,7 +415,7 @@ namespace alps {
         for (spin_t flavor=0; flavor<n_flavors; ++flavor) {
         for (size_t site1 = 0; site1 < n_site; ++site1) {
         for (size_t site2 = 0; site2 < n_site; ++site2) {
-        connected[site1][site2] = !gf.is_zero(site1, site2, flavor, eps);
+        connected[site1][site2] = !gf.is_zero(flavor, site1, site2, eps);
     }
 }
 make_groups(n_site, connected, groups[flavor], group_map[flavor]);
@@ -345,7 +434,7 @@ const int num_af = vd.num_af_states();
 for (int i_af=0; i_af<num_af; ++i_af) {
 std::valarray<int> qn_diff(0, n_dim*n_flavors);
 assert(qn_diff.size()==n_dim*n_flavors);
-for (size_t i_rank=0; i_rank<vd.rank(); ++i_rank) {
+for (size_t i_rank=0; i_rank<VERTEX_RANK; ++i_rank) {
 const spin_t flavor = vd.flavors()[i_rank];
 const size_t site1 = vd.sites()[2*i_rank];//c_dagger
 const size_t site2 = vd.sites()[2*i_rank+1];//c
@@ -27,8 +27,14 @@
 #include "U_matrix.h"
 #include "operator.hpp"
 #include "legendre.h"
+#include "basis.hpp"
+#include "basis_rotation.hpp"
 #include "update_statistics.h"
 #include "update_manager.hpp"
+#include "equilibration.hpp"
+#include "replica_exchange.hpp"
+#include "binning.hpp"
+#include "nfft.hpp"
 
 namespace alps {
     namespace ctint {
@@ -51,11 +57,19 @@ namespace alps {
         public:
             bool run(boost::function<bool ()> const & stop_callback) {
               bool done = false, stopped = false;
+              unsigned long iteration = 0;
               do {
                 this->update();
                 this->measure();
-                if (stopped || BaseType::schedule_checker.pending()) {
+                ++iteration;
+                //Processes communicating in update() must check the progress at the same iterations to avoid deadlocks.
+                //The interval may change during the run, but it changes at the same iteration on all processes.
+                const unsigned long sync_interval = Base::synchronous_check_interval();
+                const bool check = sync_interval > 0 ? iteration % sync_interval == 0
+                                                     : stopped || BaseType::schedule_checker.pending();
+                if (check) {
                   stopped = stop_callback();
+                  Base::exchange_error_estimates();
                   double local_fraction = stopped ? 1. : Base::fraction_completed();
                   BaseType::schedule_checker.update(BaseType::fraction = alps::mpi::all_reduce(BaseType::communicator, local_fraction, std::plus<double>()));
                   done = BaseType::fraction >= 1.;
@@ -69,6 +83,7 @@ namespace alps {
                   }
                 }
               } while(!done);
+              Base::finish_exchange_error_estimates();
               return !stopped;
             }
         };
@@ -213,6 +228,17 @@ namespace alps {
 
             virtual void finalize()=0;
 
+            // If positive, the progress is checked on all processes every this number of iterations
+            // (queried after each iteration)
+            virtual unsigned long synchronous_check_interval() const {
+              return 0;
+            }
+
+            // Called by all processes at each check of the progress and after the last one
+            virtual void exchange_error_estimates() {}
+
+            virtual void finish_exchange_error_estimates() {}
+
             static parameters_type &define_parameters(parameters_type &parameters) {
               return alps::mcbase::define_parameters(parameters);
             }
@@ -234,6 +260,21 @@ namespace alps {
 
             void finalize();
 
+            unsigned long synchronous_check_interval() const {
+              if (replica_exchange.enabled()) {
+                return replica_exchange.period();
+              }
+              //the pilot phase for alpha reduces its statistics over processes in update()
+              if (alpha_pilot_running()) {
+                return std::max<unsigned long>(alpha_pilot_steps / measurement_period, 1);
+              }
+              return 0;
+            }
+
+            void exchange_error_estimates();
+
+            void finish_exchange_error_estimates();
+
             typedef typename TYPES::M_TYPE M_TYPE;
             typedef typename TYPES::REAL_TYPE REAL_TYPE;
             typedef typename TYPES::COMPLEX_TYPE COMPLEX_TYPE;
@@ -246,6 +287,17 @@ namespace alps {
               return define_ctint_options(parameters);
             }
 
+            // Observables monitored by the online binning analysis
+            static std::vector<std::string> monitored_observable_names(int n_basis) {
+              std::vector<std::string> names;
+              names.push_back("Sign");
+              names.push_back("PertOrder");
+              for (int l = 0; l < std::min(n_basis, 3); ++l) {
+                names.push_back("Re Sl[0][0][0][" + boost::lexical_cast<std::string>(l) + "]");
+              }
+              return names;
+            }
+
         protected:
 
             /*functions*/
@@ -264,16 +316,39 @@ namespace alps {
 
             void compute_Sl();
 
+            //Position of the coefficient (flavor, site1, site2, l) in the flattened "Sl" observable.
+            //The real and imaginary parts are stored at 2*index and 2*index+1.
+            std::size_t Sl_index(int flavor, int site1, int site2, int l) const {
+              return ((static_cast<std::size_t>(flavor) * n_site + site1) * n_site + site2) * G1_basis->size() + l;
+            }
+
+            void add_time_shift_pilot_sample(const std::vector<double> &trace_S0, double elapsed);
+
+            void add_alpha_pilot_sample(double elapsed);
+
+            bool alpha_pilot_running() const {
+              return alpha_pilot_candidate < static_cast<int>(alpha_pilot_scales.size());
+            }
+
+            //Rebuild A^{-1} for the current configuration (e.g. after alpha is changed)
+            void rebuild_walker();
+
             void measure_densities();
 
+            void measure_G2();
+
+            void measure_chi();
+
             // in file interaction_expansion.hpp
             void sanity_check();
             //bool is_quantum_number_conserved(const itime_vertex_container& vertices);
 
             virtual bool is_thermalized() const {
-              return step > therm_steps;
+              return thermalized_;
             }
 
+            void update_thermalization_status(); //called at the end of each update() until thermalization is done
+
             void prepare_for_measurement(); //called once after thermalization is done
 
             //copy of input parameters
@@ -330,6 +405,12 @@ namespace alps {
 
             bool is_thermalized_in_previous_step_;
 
+            //thermalization (therm_steps is an upper bound if auto_thermalization is on)
+            const bool auto_thermalization;
+            EquilibrationDetector equilibration_detector;
+            bool thermalized_;
+            boost::uint64_t thermalization_steps_done;
+
             // Non-interacting GF
             itime_green_function_t bare_green_itime;
 
@@ -342,7 +423,8 @@ namespace alps {
             clock_t update_time;
             clock_t measurement_time;
 
-            LegendreTransformer legendre_transformer;
+            //Basis for measuring Sigma G (Legendre or IR)
+            boost::shared_ptr<BasisTransformer> G1_basis;
 
             std::valarray<double> pert_order_hist;
 
@@ -355,10 +437,64 @@ namespace alps {
 
             green_function<M_TYPE> g0_intpl;
 
-            VertexUpdateManager<M_TYPE> update_manager;
+            //constructed after G0 has been loaded (the quantum numbers of vertices are derived from G0)
+            boost::shared_ptr<VertexUpdateManager<M_TYPE> > update_manager;
+
+            ReplicaExchange replica_exchange;
 
             std::vector<double> timings;
 
+            //handles of the accumulators filled at every measurement (resolved in initialize_observables)
+            alps::accumulators::accumulator_wrapper *sign_obs, *pert_order_obs, *densities_obs, *ninj_obs;
+            std::vector<alps::accumulators::accumulator_wrapper *> densities_flavor_obs;
+            alps::accumulators::accumulator_wrapper *Sl_obs, *Sw_obs, *G2_obs, *chi_obs;
+
+            //online binning analysis of the observables given by monitored_observable_names()
+            std::vector<BinningAnalysis> monitored_observables;
+            std::vector<double> Sl_monitored;
+            std::chrono::system_clock::time_point measurement_start_time;
+
+            //direct measurement of Sigma G in Matsubara frequencies in compute_Sl
+            const bool direct_matsubara;
+            boost::shared_ptr<NonEquispacedFourierTransform> nfft_Sw;
+
+            //two-particle measurement with n_G2_fermionic (n_G2_bosonic) non-negative fermionic (bosonic) frequencies
+            const bool measure_G2_;
+            const int n_G2_fermionic, n_G2_bosonic;
+
+            //density-density correlation function in imaginary time (see measure_chi)
+            const bool measure_chi_;
+            const int chi_n_tau, chi_n_legendre, chi_n_reference_times;
+            LegendreTransformer chi_legendre_transformer;
+
+            //number of imaginary times in measure_densities
+            const int n_tau_densities;
+
+            //number of time shifts in compute_Sl (see add_time_shift_pilot_sample for the adaptive mode)
+            const int n_time_shifts_param;
+            int n_time_shifts;
+            static const int num_time_shift_pilot_measurements = 100;
+            std::vector<double> time_shift_pilot_means;
+            double time_shift_pilot_within_var, time_shift_pilot_within_var_per_shift;
+            double time_shift_pilot_num_shifts, time_shift_pilot_time_shifts, time_shift_pilot_time_updates;
+
+            //stopping criterion based on the relative errors of the monitored observables combined over processes
+            //(only checked once the binning analyses of all processes are reliable at min_level_error_target)
+            const double error_target;
+            static const int min_level_error_target = 6;
+            MPI_Request error_estimates_request;
+            std::vector<double> error_estimates_local, error_estimates_global;
+            double error_based_progress;
+            bool error_target_reached;
+
+            //pilot phase for the shifts of alpha before thermalization (see add_alpha_pilot_sample)
+            std::vector<double> alpha_pilot_scales;
+            const boost::uint64_t alpha_pilot_steps;
+            int alpha_pilot_candidate;
+            boost::uint64_t alpha_pilot_begin_step, alpha_pilot_steps_done;
+            static const int num_alpha_pilot_stats = 7;
+            std::vector<double> alpha_pilot_stats;
+
         };
 
 /*aux functions*/
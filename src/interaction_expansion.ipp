@@ -25,12 +25,46 @@ namespace alps {
             measurement_period(parms["measurement_period"].template as<int>()),
             almost_zero(1.e-16),
             is_thermalized_in_previous_step_(false),
-            legendre_transformer(params["G1.n_matsubara"], params["G1.n_legendre"]),
+            auto_thermalization(parms["thermalization.auto"]),
+            equilibration_detector(n_flavors + 1, parms["thermalization.min_samples"], parms["thermalization.tolerance"]),
+            thermalized_(false),
+            thermalization_steps_done(0),
+            G1_basis(make_G1_basis(parms)),
             pert_order_hist(max_order + 1),
             comm(),
             g0_intpl(),
-            update_manager(parms, Uijkl, g0_intpl, comm.rank() == 0),
-            timings(4) {
+            update_manager(),
+            replica_exchange(comm, parms["replica_exchange.n_replicas"], parms["replica_exchange.U_scale_min"],
+                             parms["replica_exchange.period"]),
+            timings(4),
+            direct_matsubara(parms["G1.direct_matsubara"]),
+            nfft_Sw(direct_matsubara ?
+                    new NonEquispacedFourierTransform(parms["G1.n_matsubara"], n_site * n_site) : 0),
+            measure_G2_(parms["G2.measure"]),
+            n_G2_fermionic(parms["G2.n_fermionic"]),
+            n_G2_bosonic(parms["G2.n_bosonic"]),
+            measure_chi_(parms["chi.measure"]),
+            chi_n_tau(parms["chi.n_tau"]),
+            chi_n_legendre(parms["chi.n_legendre"]),
+            chi_n_reference_times(parms["chi.n_reference_times"]),
+            chi_legendre_transformer(1, std::max(chi_n_legendre, 1)),
+            n_tau_densities(parms["G1.n_tau_densities"]),
+            n_time_shifts_param(parms["G1.n_time_shifts"]),
+            n_time_shifts(std::max(n_time_shifts_param, 0)),
+            time_shift_pilot_within_var(0.0),
+            time_shift_pilot_within_var_per_shift(0.0),
+            time_shift_pilot_num_shifts(0.0),
+            time_shift_pilot_time_shifts(0.0),
+            time_shift_pilot_time_updates(0.0),
+            error_target(parms["error_target"]),
+            error_estimates_request(MPI_REQUEST_NULL),
+            error_based_progress(0.0),
+            error_target_reached(false),
+            alpha_pilot_scales(),
+            alpha_pilot_steps(parms["update.alpha_pilot_steps"].template as<long>()),
+            alpha_pilot_candidate(0),
+            alpha_pilot_begin_step(0),
+            alpha_pilot_steps_done(0) {
           //other parameters
           step = 0;
           measurement_time = 0;
@@ -43,6 +77,51 @@ namespace alps {
           }
           g0_intpl.read_itime_data(params["model.G0_tau_file"], beta, n_flavors, n_site);
 
+          //simulate in the rotated single-particle basis
+          if (parms["model.basis_rotation"].template as<bool>()) {
+            //these refer to the vertex types in the original basis
+            for (const std::string& name : {"PREFIX_LOAD_CONFIG", "GLOBAL_UPDATES", "update.double_vertex_update_pairs"}) {
+              if (parms.defined(name)) {
+                throw std::runtime_error(name + " cannot be used with model.basis_rotation");
+              }
+            }
+            const std::vector<Eigen::MatrixXd> V = make_basis_rotation(parms);
+            const int num_vertices_org = Uijkl.n_vertex_type();
+            if (comm.rank() == 0) {
+              for (int flavor = 0; flavor < n_flavors; ++flavor) {
+                const std::vector<Eigen::MatrixXd> G0_mats = sample_G0_matrices(g0_intpl, flavor);
+                std::cout << "Off-diagonal weight of G0 for flavor " << flavor << ": "
+                          << off_diagonal_weight(G0_mats, Eigen::MatrixXd::Identity(n_site, n_site)) << " (original basis) -> "
+                          << off_diagonal_weight(G0_mats, V[flavor]) << " (rotated basis)" << std::endl;
+              }
+            }
+            g0_intpl.rotate_basis(V);
+            Uijkl.rotate_basis(V);
+            if (comm.rank() == 0) {
+              std::cout << "Number of vertex types: " << num_vertices_org << " (original basis) -> "
+                        << Uijkl.n_vertex_type() << " (rotated basis)" << std::endl;
+            }
+          }
+
+          update_manager.reset(new VertexUpdateManager<M_TYPE>(parms, Uijkl, g0_intpl, comm.rank() == 0));
+
+          //candidates for the shifts of alpha tried in the pilot phase
+          {
+            std::stringstream ss(parms["update.alpha_pilot_scales"].template as<std::string>());
+            double rtmp;
+            while (ss >> rtmp) {
+              Uijkl.set_alpha_shift_scale(rtmp);//throws if the scaled alpha is invalid
+              alpha_pilot_scales.push_back(rtmp);
+            }
+            if (alpha_pilot_scales.size() > 0) {
+              if (alpha_pilot_steps < 2 * measurement_period) {
+                throw std::runtime_error("update.alpha_pilot_steps must be at least twice measurement_period");
+              }
+              Uijkl.set_alpha_shift_scale(alpha_pilot_scales[0]);
+              alpha_pilot_stats.resize(num_alpha_pilot_stats * alpha_pilot_scales.size(), 0.0);
+            }
+          }
+
           //initialize the simulation variables
           initialize_simulation(parms);
 
@@ -50,6 +129,15 @@ namespace alps {
           if (params["measurement_period"].template as<int>() <= 0) {
             throw std::runtime_error("measurement_period must be specified. A reasonable value is the average expansion order");
           }
+          if (n_tau_densities <= 0) {
+            throw std::runtime_error("G1.n_tau_densities must be positive");
+          }
+          if (measure_G2_ && (n_G2_fermionic <= 0 || n_G2_bosonic <= 0)) {
+            throw std::runtime_error("G2.n_fermionic and G2.n_bosonic must be positive");
+          }
+          if (measure_chi_ && (chi_n_tau < 2 || chi_n_legendre < 0 || chi_n_reference_times <= 0)) {
+            throw std::runtime_error("chi.n_tau must be larger than 1, chi.n_legendre non-negative and chi.n_reference_times positive");
+          }
 
           //submatrix update
           itime_vertex_container itime_vertices_init;
@@ -60,7 +148,7 @@ namespace alps {
             load_config<typename TYPES::M_TYPE>(is, Uijkl, itime_vertices_init);
           }
 
-          update_manager.create_observables(measurements);
+          update_manager->create_observables(measurements);
 
           submatrix_update = WALKER_P_TYPE(
               new SubmatrixUpdate<M_TYPE>(
@@ -71,6 +159,14 @@ namespace alps {
           std::cout << " step " << step << " node " << comm.rank() << " pert " << submatrix_update->pert_order() << std::endl;
 #endif
 
+          if (replica_exchange.enabled() && comm.rank() == 0) {
+            std::cout << "Replica exchange will be performed for U_scale = ";
+            for (int r = 0; r < replica_exchange.U_scales().size(); ++r) {
+              std::cout << replica_exchange.U_scales()[r] << " ";
+            }
+            std::cout << std::endl;
+          }
+
           vertex_histograms = new simple_hist *[n_flavors];
           vertex_histogram_size = 100;
           for (unsigned int i = 0; i < n_flavors; ++i) {
@@ -105,19 +201,21 @@ namespace alps {
 #endif
 
             for (int i_ins_rem = 0; i_ins_rem < n_ins_rem; ++i_ins_rem) {
-              update_manager.do_ins_rem_update(*submatrix_update, Uijkl, random, 1.0);
+              update_manager->do_ins_rem_update(*submatrix_update, Uijkl, random, replica_exchange.U_scale());
             }
 
+            //the proposals are frozen while the pilot for alpha compares its candidates
+            const bool tune_proposals = !is_thermalized() && !alpha_pilot_running();
             for (int i_shift = 0; i_shift < n_shift; ++i_shift) {
-              update_manager.do_shift_update(*submatrix_update, Uijkl, random, false);
+              update_manager->do_shift_update(*submatrix_update, Uijkl, random, tune_proposals);
             }
 
             for (int i_spin_flip = 0; i_spin_flip < n_spin_flip; ++i_spin_flip) {
-              update_manager.do_spin_flip_update(*submatrix_update, Uijkl, random);
+              update_manager->do_spin_flip_update(*submatrix_update, Uijkl, random);
             }
 
             for (spin_t flavor = 0; flavor < n_flavors; ++flavor) {
-              vertex_histograms[flavor]->count(submatrix_update->invA()[flavor].creators().size());
+              vertex_histograms[flavor]->count(submatrix_update->invA()[flavor].num_ops());
             }
 
           }
@@ -132,11 +230,30 @@ namespace alps {
           }
           {
             auto t_start_local = std::chrono::system_clock::now();
-            update_manager.global_updates(submatrix_update, Uijkl, g0_intpl, random);
+            update_manager->global_updates(submatrix_update, Uijkl, g0_intpl, random);
             auto t_end_local = std::chrono::system_clock::now();
             timing_part[1] += std::chrono::duration_cast<std::chrono::nanoseconds>(t_end_local-t_start_local).count();
           }
 
+          if (replica_exchange.enabled()) {
+            itime_vertex_container itime_vertices = submatrix_update->itime_vertices();
+            if (replica_exchange.exchange(Uijkl, itime_vertices, random)) {
+              submatrix_update = WALKER_P_TYPE(
+                  new SubmatrixUpdate<M_TYPE>(
+                    parms["update.k_ins_max"], n_flavors,
+                    g0_intpl, &Uijkl, beta, itime_vertices));
+            }
+          }
+
+          if (!is_thermalized()) {
+            if (alpha_pilot_running()) {
+              add_alpha_pilot_sample(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now() - t_start).count());
+            } else {
+              update_manager->adapt_proposals();
+              update_thermalization_status();
+            }
+          }
           if (is_thermalized() && !is_thermalized_in_previous_step_) {
             prepare_for_measurement();
           }
@@ -155,11 +272,12 @@ namespace alps {
           auto t_start = std::chrono::system_clock::now();
 
           //In the below, real physical quantities are measured.
-          if (!is_thermalized()) {
+          //Replicas with U_scale < 1 do not measure.
+          if (!is_thermalized() || !replica_exchange.is_physical()) {
             return;
           }
           measure_observables();
-          update_manager.measure_observables(measurements);
+          update_manager->measure_observables(measurements);
 
           auto t_end = std::chrono::system_clock::now();
           timings[3] = std::chrono::duration_cast<std::chrono::nanoseconds>(t_end-t_start).count();
@@ -175,6 +293,18 @@ namespace alps {
  */
         template<class TYPES>
         void InteractionExpansion<TYPES>::finalize() {
+          //autocorrelation times and effective number of samples per second
+          if (monitored_observables[0].count() > 0) {
+            const double elapsed = 1E-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::system_clock::now() - measurement_start_time).count();
+            std::vector<double> tau_int(monitored_observables.size()), samples_per_second(monitored_observables.size());
+            for (int i = 0; i < monitored_observables.size(); ++i) {
+              tau_int[i] = monitored_observables[i].tau_int();
+              samples_per_second[i] = monitored_observables[i].effective_count() / elapsed;
+            }
+            measurements["AutocorrelationTime"] << tau_int;
+            measurements["EffectiveSamplesPerSecond"] << samples_per_second;
+          }
 
           /*
           std::string node_str = boost::lexical_cast<std::string>(comm.rank());
@@ -191,16 +321,90 @@ namespace alps {
 
         template<class TYPES>
         double InteractionExpansion<TYPES>::fraction_completed() const {
-          if (!is_thermalized()) {
-            return 0.;
+          if (error_target_reached) {
+            return 1.;
+          }
+          if (!is_thermalized() || !replica_exchange.is_physical()) {
+            return error_based_progress / comm.size();
           } else {
             //std::cout << "step debug " << step << " " << ((step - therm_steps) / (double) mc_steps) << std::endl;
             //std::cout << "step debug " << step << " " << step << " " <<  therm_steps << " " <<  mc_steps << std::endl;
-            double fraction = (static_cast<double>(step) - static_cast<double>(therm_steps))/static_cast<double>(mc_steps);
-            return fraction;
+            double fraction = (static_cast<double>(step) - static_cast<double>(thermalization_steps_done))/static_cast<double>(mc_steps);
+            return std::max(fraction, error_based_progress / comm.size());
+          }
+        }
+
+
+/**
+ * Combine the binning analyses of the sign and the leading Legendre coefficients of Sl over processes.
+ * The result of the reduction posted at the previous check is used to decide whether error_target is reached.
+ * The error of the mean over all processes is computed as sqrt(sum_r N_r^2 err_r^2)/N.
+ * Without a sign problem the error of the sign vanishes and only Sl decides.
+ * Since the binning errors are underestimated for short runs, error_target is reached only after
+ * the binning analyses of all the monitored observables are reliable on every process (BinningAnalysis::is_reliable).
+ */
+        template<class TYPES>
+        void InteractionExpansion<TYPES>::exchange_error_estimates() {
+          if (error_target <= 0.0) {
+            return;
+          }
+
+          const int n_obs = monitored_observables.size();
+          if (error_estimates_request != MPI_REQUEST_NULL) {
+            MPI_Wait(&error_estimates_request, MPI_STATUS_IGNORE);
+
+            std::vector<double> mean(n_obs), error(n_obs);
+            for (int i = 0; i < n_obs; ++i) {
+              const double N = error_estimates_global[3 * i];
+              mean[i] = N > 0 ? error_estimates_global[3 * i + 1] / N : 0.0;
+              error[i] = N > 0 ? std::sqrt(error_estimates_global[3 * i + 2]) / N : 0.0;
+            }
+            double relative_error = error[0] / std::abs(mean[0]);
+            if (n_obs > 2) {
+              //The errors of Sl are measured relative to the largest coefficient
+              //because some coefficients vanish by symmetry.
+              double max_abs_Sl = 0.0, max_error_Sl = 0.0;
+              for (int i = 2; i < n_obs; ++i) {
+                max_abs_Sl = std::max(max_abs_Sl, std::abs(mean[i]));
+                max_error_Sl = std::max(max_error_Sl, error[i]);
+              }
+              relative_error = std::max(relative_error, max_error_Sl / max_abs_Sl);
+            }
+
+            if (error_estimates_global[0] > 0 && std::isfinite(relative_error)) {
+              //the number of samples required is proportional to the square of the relative error
+              error_based_progress = std::min(std::pow(error_target / relative_error, 2.0), 1.0);
+              const bool reliable = error_estimates_global[3 * n_obs] == comm.size();
+              error_target_reached = reliable && relative_error < error_target;
+              if (comm.rank() == 0) {
+                std::cout << "Relative error: " << relative_error << " (target " << error_target << ")" << std::endl;
+              }
+            }
           }
+
+          //the last element counts the processes whose binning analyses are all reliable
+          error_estimates_local.resize(3 * n_obs + 1);
+          error_estimates_global.resize(3 * n_obs + 1);
+          bool reliable = true;
+          for (int i = 0; i < n_obs; ++i) {
+            const double N = monitored_observables[i].count();
+            const double error = monitored_observables[i].error();
+            error_estimates_local[3 * i] = N;
+            error_estimates_local[3 * i + 1] = N * monitored_observables[i].mean();
+            error_estimates_local[3 * i + 2] = N * N * error * error;
+            reliable = reliable && monitored_observables[i].is_reliable(min_level_error_target);
+          }
+          error_estimates_local[3 * n_obs] = reliable ? 1.0 : 0.0;
+          MPI_Iallreduce(error_estimates_local.data(), error_estimates_global.data(), 3 * n_obs + 1, MPI_DOUBLE,
+                         MPI_SUM, comm, &error_estimates_request);
         }
 
+        template<class TYPES>
+        void InteractionExpansion<TYPES>::finish_exchange_error_estimates() {
+          if (error_estimates_request != MPI_REQUEST_NULL) {
+            MPI_Wait(&error_estimates_request, MPI_STATUS_IGNORE);
+          }
+        }
 
 ///do all the setup that has to be done before running the simulation.
         template<class TYPES>
@@ -275,11 +479,112 @@ bool InteractionExpansion<TYPES>::is_quantum_number_within_range(const itime_ver
         }
 
 
+        template<class TYPES>
+        void InteractionExpansion<TYPES>::update_thermalization_status() {
+          if (step > therm_steps + alpha_pilot_steps_done) {
+            thermalized_ = true;
+          } else if (auto_thermalization) {
+            //perturbation order of each flavor and sign
+            std::vector<double> sample(n_flavors + 1);
+            for (spin_t flavor = 0; flavor < n_flavors; ++flavor) {
+              sample[flavor] = submatrix_update->invA()[flavor].num_ops();
+            }
+            sample[n_flavors] = mycast<double>(submatrix_update->sign());
+            equilibration_detector.add_sample(sample);
+            thermalized_ = equilibration_detector.is_stationary();
+          }
+
+          if (thermalized_) {
+            thermalization_steps_done = step;
+          }
+        }
+
         template<class TYPES>
         void InteractionExpansion<TYPES>::prepare_for_measurement() {
           //std::cout << "prepare for meas" << std::endl;
-          std::cout << "Rank " << comm.rank() << ": thermalization done!" << std::endl;
-          update_manager.prepare_for_measurement_steps();
+          std::cout << "Rank " << comm.rank() << ": thermalization done after " << thermalization_steps_done << " steps!" << std::endl;
+          measurement_start_time = std::chrono::system_clock::now();
+          update_manager->prepare_for_measurement_steps();
+          if (replica_exchange.is_physical()) {
+            measurements["ThermalizationSteps"] << static_cast<double>(thermalization_steps_done);
+          }
+        }
+
+        template<class TYPES>
+        void InteractionExpansion<TYPES>::rebuild_walker() {
+          const itime_vertex_container itime_vertices = submatrix_update->itime_vertices();
+          submatrix_update = WALKER_P_TYPE(
+              new SubmatrixUpdate<M_TYPE>(
+                parms["update.k_ins_max"], n_flavors,
+                g0_intpl, &Uijkl, beta, itime_vertices));
+        }
+
+        /**
+         * Pilot phase for the shifts of alpha from 0 or 1.
+         * Each candidate scale is run for alpha_pilot_steps steps starting from the current configuration.
+         * The second half is used to estimate the average sign, the acceptance rate of insertions/removals and the
+         * computational time per step (which grows with the average perturbation order).
+         * The candidate minimizing the estimated cost per effective sample, time/(sign^2 * acceptance rate),
+         * over all processes is used for thermalization and measurement.
+         */
+        template<class TYPES>
+        void InteractionExpansion<TYPES>::add_alpha_pilot_sample(double elapsed) {
+          const boost::uint64_t steps_candidate = step - alpha_pilot_begin_step;
+          if (2 * steps_candidate <= alpha_pilot_steps) {
+            update_manager->reset_ins_rem_acceptance();
+            return;
+          }
+
+          double *stats = &alpha_pilot_stats[num_alpha_pilot_stats * alpha_pilot_candidate];
+          const M_TYPE current_sign = submatrix_update->sign();
+          stats[0] += 1.0;
+          stats[1] += submatrix_update->pert_order();
+          stats[2] += std::real(current_sign);
+          stats[3] += std::imag(current_sign);
+          stats[4] += elapsed;
+          if (steps_candidate < alpha_pilot_steps) {
+            return;
+          }
+          boost::tie(stats[5], stats[6]) = update_manager->ins_rem_acceptance();
+
+          ++alpha_pilot_candidate;
+          const int num_candidates = alpha_pilot_scales.size();
+          if (alpha_pilot_candidate < num_candidates) {
+            Uijkl.set_alpha_shift_scale(alpha_pilot_scales[alpha_pilot_candidate]);
+            rebuild_walker();
+            alpha_pilot_begin_step = step;
+            return;
+          }
+
+          //all the processes choose the same candidate
+          std::vector<double> stats_global(alpha_pilot_stats.size());
+          MPI_Allreduce(alpha_pilot_stats.data(), stats_global.data(), alpha_pilot_stats.size(), MPI_DOUBLE, MPI_SUM, comm);
+
+          std::vector<double> order(num_candidates), sign(num_candidates), acc_rate(num_candidates),
+            time_per_step(num_candidates), cost(num_candidates);
+          for (int c = 0; c < num_candidates; ++c) {
+            const double *g = &stats_global[num_alpha_pilot_stats * c];
+            order[c] = g[1] / g[0];
+            sign[c] = std::abs(std::complex<double>(g[2], g[3])) / g[0];
+            acc_rate[c] = g[6] > 0 ? g[5] / g[6] : 0.0;
+            time_per_step[c] = g[4] / g[0];
+            cost[c] = sign[c] > 0 && acc_rate[c] > 0 ?
+                      time_per_step[c] / (sign[c] * sign[c] * acc_rate[c]) : std::numeric_limits<double>::infinity();
+          }
+          const int best = std::min_element(cost.begin(), cost.end()) - cost.begin();
+
+          if (comm.rank() == 0) {
+            std::cout << "Pilot phase for alpha (scale, average order, average sign, acceptance rate, ms per step, relative cost):" << std::endl;
+            for (int c = 0; c < num_candidates; ++c) {
+              std::cout << " " << alpha_pilot_scales[c] << " " << order[c] << " " << sign[c] << " " << acc_rate[c] << " "
+                        << 1E-6 * time_per_step[c] << " " << cost[c] / cost[best] << std::endl;
+            }
+            std::cout << "The shifts of alpha are scaled by " << alpha_pilot_scales[best] << std::endl;
+          }
+
+          Uijkl.set_alpha_shift_scale(alpha_pilot_scales[best]);
+          rebuild_walker();
+          alpha_pilot_steps_done = step;
         }
 
         template<typename T, typename SPLINE_G0>
@@ -296,7 +601,7 @@ bool InteractionExpansion<TYPES>::is_quantum_number_within_range(const itime_ver
             const itime_vertex &v = itime_vertices[iv];
             const vertex_definition<T> &vdef = Uijkl.get_vertex(v.type());
             weight_U *= -vdef.Uval();
-            for (int rank = 0; rank < v.rank(); ++rank) {
+            for (int rank = 0; rank < VERTEX_RANK; ++rank) {
               const int flavor_rank = vdef.flavors()[rank];
               operator_time op_t(v.time(), -rank);
               creators[flavor_rank].push_back(
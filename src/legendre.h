@@ -72,25 +72,30 @@ namespace alps {
                                                   boost::multi_array<double, 2> &val) const {
               assert(val.shape()[0] >= n_legendre_);
               const int nx = xval.size();
+              assert(val.shape()[1] >= nx && val.strides()[1] == 1);
+              //raw pointers to the rows avoid the indexing overhead of multi_array in the inner loops
+              const std::size_t stride = val.strides()[0];
               for (int l = 0; l < n_legendre_; l++) {
+                double *val_l = val.origin() + l * stride;
                 if (l == 0) {
 #pragma clang loop vectorize(enable)
                   for (int ix = 0; ix < nx; ++ix) {
-                    val[l][ix] = 1;
+                    val_l[ix] = 1;
                   }
                 } else if (l == 1) {
 #pragma clang loop vectorize(enable)
                   for (int ix = 0; ix < nx; ++ix) {
-                    val[l][ix] = xval[ix];
+                    val_l[ix] = xval[ix];
                   }
                 } else {
                   //for (int ix=0; ix<nx; ++ix) {
                   //val[ix][l] = ((2 * l - 1) * xval[ix]*val[ix][l - 1] - (l - 1) * val[ix][l - 2]) * inv_l_[l];//l
                   //}
                   const double inv_l_tmp = inv_l_[l];
+                  const double *val_lm1 = val_l - stride, *val_lm2 = val_l - 2 * stride;
 #pragma clang loop vectorize(enable)
                   for (int ix = 0; ix < nx; ++ix) {
-                    val[l][ix] = ((2 * l - 1) * xval[ix] * val[l - 1][ix] - (l - 1) * val[l - 2][ix]) * inv_l_tmp;//l
+                    val_l[ix] = ((2 * l - 1) * xval[ix] * val_lm1[ix] - (l - 1) * val_lm2[ix]) * inv_l_tmp;//l
                   }
                 }
               }
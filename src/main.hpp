@@ -33,6 +33,7 @@ namespace alps {
           std::cout << "Running simulation on rank " << comm.rank() << std::endl;
           my_sim_type my_sim(par, comm);
           my_sim.run(alps::stop_callback(par["timelimit"].template as<std::size_t>()));
+          my_sim.finalize();
 
           // Collect the results from the simulation
           std::cout << "Rank " << comm.rank() << " has finished. Collecting results..." << std::endl;
@@ -12,26 +12,42 @@ namespace alps {
 /// Allocation of memory for the ALPS observables.
         template<class TYPES>
         void InteractionExpansion<TYPES>::initialize_observables(void) {
-          measurements << SimpleRealObservable("Sign");
+          measurements << JackknifeRealObservable("Sign");
           measurements << SimpleRealVectorObservable("PertOrder");
 
-          for (unsigned int flavor = 0; flavor < n_flavors; ++flavor) {
-            for (unsigned int k = 0; k < n_site; k++) {
-              for (unsigned int k2 = 0; k2 < n_site; k2++) {
-                std::stringstream obs_name_real, obs_name_imag;
-                obs_name_real << "Sl_real_" << flavor << "_" << k << "_" << k2;
-                obs_name_imag << "Sl_imag_" << flavor << "_" << k << "_" << k2;
-                measurements << SimpleRealVectorObservable(obs_name_real.str().c_str());
-                measurements << SimpleRealVectorObservable(obs_name_imag.str().c_str());
-              }
-            }
+          // Legendre coefficients of Sigma G for all flavors and sites in a single flattened vector (see Sl_index)
+          // Large vectors are binned logarithmically; full binning is kept only for the sign and the densities.
+          measurements << BinnedRealVectorObservable("Sl");
+          Sl_obs = &measurements["Sl"];
+
+          // Sigma G(i omega_n) measured directly with the shape [flavor][site1][site2][n][real/imag]
+          if (direct_matsubara) {
+            measurements << SimpleRealVectorObservable("Sw");
+            Sw_obs = &measurements["Sw"];
+          }
+
+          // Two-particle Green's function (see measure_G2)
+          if (measure_G2_) {
+            measurements << JackknifeRealVectorObservable("G2");
+            G2_obs = &measurements["G2"];
+          }
+
+          // Density-density correlation function in imaginary time (see measure_chi)
+          if (measure_chi_) {
+            measurements << SimpleRealVectorObservable("chi");
+            chi_obs = &measurements["chi"];
           }
 
-          measurements << SimpleRealVectorObservable("densities");
+          measurements << JackknifeRealVectorObservable("densities");
           for (int flavor = 0; flavor < n_flavors; ++flavor) {
             measurements << SimpleRealVectorObservable("densities_" + boost::lexical_cast<std::string>(flavor));
+            densities_flavor_obs.push_back(&measurements["densities_" + boost::lexical_cast<std::string>(flavor)]);
           }
-          measurements << SimpleRealVectorObservable("n_i n_j");
+          measurements << BinnedRealVectorObservable("n_i n_j");
+          sign_obs = &measurements["Sign"];
+          pert_order_obs = &measurements["PertOrder"];
+          densities_obs = &measurements["densities"];
+          ninj_obs = &measurements["n_i n_j"];
 
           for (unsigned int flavor = 0; flavor < n_flavors; ++flavor) {
             for (unsigned int i = 0; i < n_site; ++i) {
@@ -46,6 +62,15 @@ namespace alps {
 
           // Timings for MC update and measuremrent
           measurements << SimpleRealVectorObservable("Timings");
+
+          // Number of steps spent for thermalization (one sample per process)
+          measurements << SimpleRealObservable("ThermalizationSteps");
+
+          // Results of online binning analysis (one sample per process, see BinningAnalysis for the definition of tau_int)
+          monitored_observables.resize(monitored_observable_names(G1_basis->size()).size());
+          Sl_monitored.resize(monitored_observables.size() - 2);
+          measurements << SimpleRealVectorObservable("AutocorrelationTime");
+          measurements << SimpleRealVectorObservable("EffectiveSamplesPerSecond");
         }
 
 ///this function is called whenever measurements should be performed. Depending
@@ -57,7 +82,7 @@ namespace alps {
           submatrix_update->compute_M(M_flavors);
           const M_TYPE sign = submatrix_update->sign();
 
-          measurements["Sign"] << alps::numeric::real(sign);
+          *sign_obs << alps::numeric::real(sign);
           /*
           if (parms.defined("OUTPUT_Sign") ? parms["OUTPUT_Sign"] : false) {
             std::cout << " node= " << comm.rank() << " Sign= " << sign << " pert_order= "
@@ -67,6 +92,12 @@ namespace alps {
 
           compute_Sl();
           measure_densities();
+          if (measure_G2_) {
+            measure_G2();
+          }
+          if (measure_chi_) {
+            measure_chi();
+          }
 
           //pert_order_hist /= pert_order_hist.sum();
           //measurements["PertOrderHistogram"] << pert_order_hist;
@@ -75,7 +106,13 @@ namespace alps {
           for (unsigned int i = 0; i < n_flavors; ++i) {
             pert_order[i] = M_flavors[i].size1();
           }
-          measurements["PertOrder"] << pert_order;
+          *pert_order_obs << pert_order;
+
+          monitored_observables[0].add_sample(alps::numeric::real(sign));
+          monitored_observables[1].add_sample(std::accumulate(pert_order.begin(), pert_order.end(), 0.0));
+          for (int l = 0; l < Sl_monitored.size(); ++l) {
+            monitored_observables[l + 2].add_sample(Sl_monitored[l]);
+          }
 
           /*
           for (spin_t flavor = 0; flavor < n_flavors; ++flavor) {
@@ -97,8 +134,10 @@ namespace alps {
 
         template<class TYPES>
         void InteractionExpansion<TYPES>::compute_Sl() {
-          int n_legendre = legendre_transformer.Nl();
-          static boost::multi_array<std::complex<double>, 3> Sl(boost::extents[n_site][n_site][n_legendre]);
+          typedef Eigen::Matrix<M_TYPE, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+          typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> row_major_matrix_t;
+
+          const int n_basis = G1_basis->size();
 
           const M_TYPE sign = submatrix_update->sign();
           const double temperature = 1.0 / beta;
@@ -108,126 +147,352 @@ namespace alps {
           for (unsigned int z = 0; z < n_flavors; ++z) {
             max_mat_size = std::max(max_mat_size, M_flavors[z].size2());
           }
-          const std::vector<double> &sqrt_vals = legendre_transformer.get_sqrt_2l_1();
 
-          const size_t num_random_walk = max_mat_size;
+          //Number of time shifts: the expansion order (legacy), a fixed number or chosen adaptively after pilot measurements
+          const bool pilot = n_time_shifts_param == 0 && n_time_shifts == 0;
+          const size_t num_random_walk = n_time_shifts_param < 0 ? max_mat_size :
+                                         (pilot ? std::max(max_mat_size, 2) : n_time_shifts);
+          auto t_start = std::chrono::system_clock::now();
+          //Estimates of trace of S_{l=0} for each time shift (only for pilot measurements)
+          std::vector<double> trace_S0(pilot ? num_random_walk : 0, 0.0);
 
-          std::vector<double> x_vals;
-          boost::multi_array<double, 2> legendre_vals_all; //, legendre_vals_trans_all;
+          //Time shifts are processed in batches of about this number of operators
+          const int batch_num_operators = 1024;
 
-          alps::numeric::matrix<M_TYPE> gR(max_mat_size, n_site), M_gR(max_mat_size, n_site);
+          std::vector<double> x_vals, coeffs;
+          boost::multi_array<double, 2> basis_vals_all(boost::extents[n_basis][0]);
+
+          matrix_t gR, M_gR, M_gR_sorted;
+          Eigen::MatrixXd Pl;
+          std::vector<matrix_t> Sl_site(n_site);
+
+          //Flavors without vertices contribute zero
+          std::vector<double> Sl_flat(2 * n_flavors * n_site * n_site * n_basis, 0.0);
+
+          //Direct measurement of Sigma G(i omega_n): (Sigma G)_{cB}(i omega_n) = sum_{q,p} exp(i omega_n tau_q) M_{qp} G0_{pB}(tau_p)
+          //is a sum over the (shifted) creation operators, which is evaluated by a non-equispaced FFT
+          std::vector<double> Sw_flat(direct_matsubara ? 2 * n_flavors * n_site * n_site * nfft_Sw->n_freq() : 0, 0.0);
+          std::vector<std::complex<double> > nfft_values(n_site), Sw_site;
 
           for (unsigned int z = 0; z < n_flavors; ++z) {
-            std::fill(Sl.origin(), Sl.origin() + Sl.num_elements(), 0.0);//clear the content for safety
             int Nv = M_flavors[z].size2();
 
             if (Nv == 0) {
               continue;
             }
-            gR.destructive_resize(Nv, n_site);
-            M_gR.destructive_resize(Nv, n_site);
 
-            x_vals.resize(Nv);
-            legendre_vals_all.resize(boost::extents[n_legendre][Nv]);
+            const std::vector<itime_t> &op_times = submatrix_update->invA()[z].times();
+            const std::vector<site_t> &creator_sites = submatrix_update->invA()[z].creator_sites();
+            const std::vector<site_t> &annihilator_sites = submatrix_update->invA()[z].annihilator_sites();
+
+            //creation operators sorted by site:
+            //operators q_sorted[i] for site_offset[c] <= i < site_offset[c+1] are on site c
+            std::vector<int> q_sorted(Nv), site_offset(n_site + 1, 0);
+            for (unsigned int q = 0; q < Nv; ++q) {
+              ++site_offset[creator_sites[q] + 1];
+            }
+            std::partial_sum(site_offset.begin(), site_offset.end(), site_offset.begin());
+            {
+              std::vector<int> pos(site_offset.begin(), site_offset.end() - 1);
+              for (unsigned int q = 0; q < Nv; ++q) {
+                q_sorted[pos[creator_sites[q]]++] = q;
+              }
+            }
 
-            const std::vector<annihilator> &annihilators = submatrix_update->invA()[z].annihilators();
-            const std::vector<creator> &creators = submatrix_update->invA()[z].creators();
+            for (unsigned int site_c = 0; site_c < n_site; ++site_c) {
+              Sl_site[site_c].setZero(n_basis, n_site);
+            }
+            if (direct_matsubara) {
+              nfft_Sw->clear();
+            }
 
             //shift times of operators by time_shift
-            for (std::size_t random_walk = 0; random_walk < num_random_walk; ++random_walk) {
+            const int batch_size = std::max(1, batch_num_operators / Nv);
+            for (std::size_t shift_begin = 0; shift_begin < num_random_walk; shift_begin += batch_size) {
+              const int n_shifts = std::min<int>(batch_size, num_random_walk - shift_begin);
+
+              //G0 for all the time shifts in the batch: gR(p, n_site * shift + site_B)
+              gR.resize(Nv, n_site * n_shifts);
+              //Operators in the batch are ordered by site of the creation operator, time shift and operator
+              x_vals.resize(Nv * n_shifts);
+              coeffs.resize(Nv * n_shifts);
+              for (int shift = 0; shift < n_shifts; ++shift) {
+                const double time_shift = beta * random();
+
+                for (unsigned int p = 0; p < Nv; ++p) {//annihilation operators
+                  const double time_a = op_times[p] + time_shift;
+
+                  //interpolate G0
+                  for (unsigned int site_B = 0; site_B < n_site; ++site_B) {
+                    gR(p, n_site * shift + site_B) = mycast<M_TYPE>(g0_intpl(time_a, z, annihilator_sites[p], site_B));
+                  }
+                }
 
-              const double time_shift = beta * random();
+                for (unsigned int site_c = 0; site_c < n_site; ++site_c) {//creation operators
+                  const int n_c = site_offset[site_c + 1] - site_offset[site_c];
+                  for (int i = 0; i < n_c; ++i) {
+                    const int q = q_sorted[site_offset[site_c] + i];
+                    const int idx = n_shifts * site_offset[site_c] + n_c * shift + i;
+                    const double tmp = op_times[q] + time_shift;
+                    const double time_c_shifted = tmp < beta ? tmp : tmp - beta;
+                    x_vals[idx] = 2 * time_c_shifted * temperature - 1.0;
+                    coeffs[idx] = tmp < beta ? 1 : -1;
+                  }
+                }
+              }
 
-              for (unsigned int p = 0; p < Nv; ++p) {//annihilation operators
-                const double time_a = annihilators[p].t().time() + time_shift;
+              M_gR.noalias() = M_flavors[z].block() * gR;
 
-                //interpolate G0
-                for (unsigned int site_B = 0; site_B < n_site; ++site_B) {
-                  gR(p, site_B) = mycast<M_TYPE>(g0_intpl(time_a, z, annihilators[p].s(), site_B));
+              if (pilot) {
+                for (int shift = 0; shift < n_shifts; ++shift) {
+                  for (unsigned int site_c = 0; site_c < n_site; ++site_c) {
+                    const int n_c = site_offset[site_c + 1] - site_offset[site_c];
+                    for (int i = 0; i < n_c; ++i) {
+                      trace_S0[shift_begin + shift] += coeffs[n_shifts * site_offset[site_c] + n_c * shift + i] *
+                        std::real(M_gR(q_sorted[site_offset[site_c] + i], n_site * shift + site_c));
+                    }
+                  }
                 }
               }
 
-              gemm(M_flavors[z], gR, M_gR);
-
-              //compute legendre coefficients
-              for (unsigned int q = 0; q < Nv; ++q) {//creation operators
-                const double tmp = creators[q].t().time() + time_shift;
-                const double time_c_shifted = tmp < beta ? tmp : tmp - beta;
-                x_vals[q] = 2 * time_c_shifted * temperature - 1.0;
+              //compute coefficients in the basis of G1
+              if (basis_vals_all.shape()[1] < Nv * n_shifts) {
+                basis_vals_all.resize(boost::extents[n_basis][Nv * n_shifts]);
+              }
+              G1_basis->compute_projectors(x_vals, basis_vals_all);//W_l[x(tau_q)]
+              Pl.noalias() = Eigen::Map<const row_major_matrix_t, 0, Eigen::OuterStride<> >(
+                               basis_vals_all.origin(), n_basis, Nv * n_shifts,
+                               Eigen::OuterStride<>(basis_vals_all.shape()[1])) *
+                             Eigen::Map<const Eigen::VectorXd>(coeffs.data(), Nv * n_shifts).asDiagonal();
+
+              if (direct_matsubara) {
+                //exp(i omega_n tau) = exp(i pi tau/beta) exp(2 pi i n tau/beta) with tau in [0, beta) times the sign coeffs
+                for (unsigned int site_c = 0; site_c < n_site; ++site_c) {
+                  const int n_c = site_offset[site_c + 1] - site_offset[site_c];
+                  for (int shift = 0; shift < n_shifts; ++shift) {
+                    for (int i = 0; i < n_c; ++i) {
+                      const int idx = n_shifts * site_offset[site_c] + n_c * shift + i;
+                      const int q = q_sorted[site_offset[site_c] + i];
+                      const double phase = 0.5 * M_PI * (x_vals[idx] + 1);
+                      const std::complex<double> factor = coeffs[idx] * std::polar(1.0, phase);
+                      for (unsigned int site_B = 0; site_B < n_site; ++site_B) {
+                        nfft_values[site_B] = factor * static_cast<std::complex<double> >(M_gR(q, n_site * shift + site_B));
+                      }
+                      nfft_Sw->add(2 * phase, nfft_values.data(), site_c * n_site, n_site);
+                    }
+                  }
+                }
               }
-              legendre_transformer.compute_legendre(x_vals, legendre_vals_all);//P_l[x(tau_q)]
-
-              for (unsigned int q = 0; q < Nv; ++q) {//creation operators
-                const unsigned int site_c = creators[q].s();
-                const double tmp = creators[q].t().time() + time_shift;
-                const double coeff = tmp < beta ? 1 : -1;
-
-                const int n_legendre_tmp = n_legendre;
-                for (unsigned int site_B = 0; site_B < n_site; ++site_B) {
-                  for (unsigned int i_legendre = 0; i_legendre < n_legendre_tmp; ++i_legendre) {
-                    Sl[site_c][site_B][i_legendre] += // + is correct?
-                      coeff * sqrt_vals[i_legendre] * legendre_vals_all[i_legendre][q] * M_gR(q, site_B);
+
+              //rows of M_gR in the same order as the columns of Pl
+              M_gR_sorted.resize(Nv * n_shifts, n_site);
+              for (unsigned int site_c = 0; site_c < n_site; ++site_c) {
+                const int n_c = site_offset[site_c + 1] - site_offset[site_c];
+                for (int shift = 0; shift < n_shifts; ++shift) {
+                  for (int i = 0; i < n_c; ++i) {
+                    M_gR_sorted.row(n_shifts * site_offset[site_c] + n_c * shift + i) =
+                      M_gR.block(q_sorted[site_offset[site_c] + i], n_site * shift, 1, n_site);
                   }
                 }
               }
+
+              for (unsigned int site_c = 0; site_c < n_site; ++site_c) {
+                const int n_c = n_shifts * (site_offset[site_c + 1] - site_offset[site_c]);
+                if (n_c > 0) {
+                  Sl_site[site_c].noalias() +=
+                    Pl.block(0, n_shifts * site_offset[site_c], n_basis, n_c) *
+                    M_gR_sorted.block(n_shifts * site_offset[site_c], 0, n_c, n_site);
+                }
+              }
             }//random_walk
 
-            //pass data to ALPS library
-            std::vector<double> Sl_real(n_legendre, 0.0);
-            std::vector<double> Sl_imag(n_legendre, 0.0);
+            if (direct_matsubara) {
+              const int n_freq = nfft_Sw->n_freq();
+              for (unsigned int site1 = 0; site1 < n_site; ++site1) {
+                for (unsigned int site2 = 0; site2 < n_site; ++site2) {
+                  nfft_Sw->transform(site1 * n_site + site2, Sw_site);
+                  for (int n = 0; n < n_freq; ++n) {
+                    const std::complex<double> ztmp = (Sw_site[n] * sign) / static_cast<double>(num_random_walk);
+                    const std::size_t idx = ((z * n_site + site1) * n_site + site2) * n_freq + n;
+                    Sw_flat[2 * idx] = ztmp.real();
+                    Sw_flat[2 * idx + 1] = ztmp.imag();
+                  }
+                }
+              }
+            }
+
             for (unsigned int site1 = 0; site1 < n_site; ++site1) {
               for (unsigned int site2 = 0; site2 < n_site; ++site2) {
-                for (unsigned int i_legendre = 0; i_legendre < n_legendre; ++i_legendre) {
+                for (unsigned int i_basis = 0; i_basis < n_basis; ++i_basis) {
                   const std::complex<double> ztmp =
-                    (Sl[site1][site2][i_legendre] * sign) / static_cast<double>(num_random_walk);
-                  Sl_real[i_legendre] = ztmp.real();
-                  Sl_imag[i_legendre] = ztmp.imag();
+                    (std::complex<double>(Sl_site[site1](i_basis, site2)) * sign) /
+                    static_cast<double>(num_random_walk);
+                  const std::size_t idx = Sl_index(z, site1, site2, i_basis);
+                  Sl_flat[2 * idx] = ztmp.real();
+                  Sl_flat[2 * idx + 1] = ztmp.imag();
                 }
-                std::stringstream Sl_real_name, Sl_imag_name;
-                Sl_real_name << "Sl_real_" << z << "_" << site1 << "_" << site2;
-                Sl_imag_name << "Sl_imag_" << z << "_" << site1 << "_" << site2;
-                measurements[Sl_real_name.str()] << Sl_real;
-                measurements[Sl_imag_name.str()] << Sl_imag;
               }//site2
             }//site1
           }//z
+
+          //pass data to ALPS library
+          *Sl_obs << Sl_flat;
+          if (direct_matsubara) {
+            *Sw_obs << Sw_flat;
+          }
+          for (int l = 0; l < Sl_monitored.size(); ++l) {
+            Sl_monitored[l] = Sl_flat[2 * Sl_index(0, 0, 0, l)];
+          }
+
+          if (pilot) {
+            const double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::system_clock::now() - t_start).count();
+            add_time_shift_pilot_sample(trace_S0, elapsed);
+          }
+        }
+
+        /**
+         * Choose the number of time shifts S in compute_Sl which minimizes (error bar)^2 x (CPU time).
+         * The variance of a measurement is modeled as B + W/S,
+         * where B is the variance between configurations and W the variance between time shifts in one configuration.
+         * The CPU time per measurement is modeled as T_u + c_1 S,
+         * where T_u is the time for the Monte Carlo updates and c_1 the time per time shift.
+         * The optimal value is S = sqrt(W T_u / (B c_1)), which is bounded by the average expansion order
+         * (the number of time shifts used in the legacy mode).
+         */
+        template<class TYPES>
+        void InteractionExpansion<TYPES>::add_time_shift_pilot_sample(const std::vector<double> &trace_S0, double elapsed) {
+          const int S = trace_S0.size();
+          const double mean = std::accumulate(trace_S0.begin(), trace_S0.end(), 0.0) / S;
+          double var = 0.0;
+          for (int s = 0; s < S; ++s) {
+            var += (trace_S0[s] - mean) * (trace_S0[s] - mean);
+          }
+          var /= (S - 1);
+
+          time_shift_pilot_means.push_back(mean);
+          time_shift_pilot_within_var += var;
+          time_shift_pilot_within_var_per_shift += var / S;
+          time_shift_pilot_num_shifts += S;
+          time_shift_pilot_time_shifts += elapsed;
+          time_shift_pilot_time_updates += timings[0] + timings[1] + timings[2];
+
+          const int M = time_shift_pilot_means.size();
+          if (M < num_time_shift_pilot_measurements) {
+            return;
+          }
+
+          const double W = time_shift_pilot_within_var / M;
+          const double mean_all = std::accumulate(time_shift_pilot_means.begin(), time_shift_pilot_means.end(), 0.0) / M;
+          double var_means = 0.0;
+          for (int m = 0; m < M; ++m) {
+            var_means += (time_shift_pilot_means[m] - mean_all) * (time_shift_pilot_means[m] - mean_all);
+          }
+          var_means /= (M - 1);
+          const double B = var_means - time_shift_pilot_within_var_per_shift / M;
+          const double c1 = time_shift_pilot_time_shifts / time_shift_pilot_num_shifts;
+          const double T_u = time_shift_pilot_time_updates / M;
+          const int S_max = std::max(1, static_cast<int>(time_shift_pilot_num_shifts / M));
+
+          if (B > 0.0 && c1 > 0.0) {
+            n_time_shifts = std::max(1, std::min(S_max, static_cast<int>(std::round(std::sqrt(W * T_u / (B * c1))))));
+          } else {
+            n_time_shifts = S_max;
+          }
+
+          std::cout << "Rank " << comm.rank() << ": number of time shifts in the measurement of Sl is set to "
+                    << n_time_shifts << " (variance within/between configurations = " << W << " / " << B
+                    << ", time per shift = " << 1E-6 * c1 << " ms, time per update = " << 1E-6 * T_u << " ms)"
+                    << std::endl;
+          time_shift_pilot_means.clear();
         }
 
 
         template<class TYPES>
         void InteractionExpansion<TYPES>::measure_densities() {
+          typedef Eigen::Matrix<M_TYPE, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+
           const M_TYPE sign = submatrix_update->sign();
+          double sign_real = mycast<double>(sign);
 
-          std::vector<std::vector<double> > dens(n_flavors);
-          for (unsigned int z = 0; z < n_flavors; ++z) {
-            dens[z].resize(n_site);
-            memset(&(dens[z][0]), 0., sizeof(double) * (n_site));
+          //equally spaced imaginary times with a random offset
+          const int K = n_tau_densities;
+          std::vector<double> taus(K);
+          const double tau_offset = random();
+          for (int k = 0; k < K; ++k) {
+            taus[k] = beta * (k + tau_offset) / K;
           }
-          double tau = beta * random();
-          double sign_real = mycast<double>(sign);
+
+          //equal-time density matrices D[z][k](a, b) = <c^dagger_{z,b}(tau_k) c_{z,a}(tau_k)>
+          //  = G0_{ab}(-0) - sum_{ij} G0_{a,c_i}(tau_k - tau_i) M_{ij} G0_{a_j,b}(tau_j - tau_k)
+          std::vector<std::vector<matrix_t> > D(n_flavors, std::vector<matrix_t>(K));
+          matrix_t g0_minus0(n_site, n_site), g0_L, g0_R, M_g0_R;
+          std::vector<M_TYPE> g0_row(n_site);
           for (unsigned int z = 0; z < n_flavors; ++z) {
-            const size_t Nv = M_flavors[z].size2();
-            const std::vector<annihilator> &annihilators = submatrix_update->invA()[z].annihilators();
-            const std::vector<creator> &creators = submatrix_update->invA()[z].creators();
-
-            using eigen_vector_t = Eigen::Matrix<M_TYPE, Eigen::Dynamic, 1>;
-            eigen_vector_t g0_tauj(Nv), M_g0_tauj(Nv), g0_taui(Nv);
-
-            for (unsigned int s = 0; s < n_site; ++s) {
-              for (unsigned int j = 0; j < Nv; ++j)
-                g0_tauj[j] = mycast<M_TYPE>(g0_intpl(annihilators[j].t().time() - tau, z, annihilators[j].s(),
-                                                     s));//CHECK THE TREATMENT OF EQUAL-TIME Green's function
-              for (unsigned int i = 0; i < Nv; ++i)
-                g0_taui[i] = mycast<M_TYPE>(g0_intpl(tau - creators[i].t().time(), z, s, creators[i].s()));
-              if (M_flavors[z].size2() > 0) {
-                M_g0_tauj = M_flavors[z].block() * g0_tauj;
+            for (unsigned int a = 0; a < n_site; ++a) {
+              for (unsigned int b = 0; b < n_site; ++b) {
+                g0_minus0(a, b) = mycast<M_TYPE>(g0_intpl(-beta * 1E-10, z, a, b));//tau=-0
               }
-              dens[z][s] += mycast<double>(g0_intpl(-beta * 1E-10, z, s, s));//tau=-0
-              for (unsigned int j = 0; j < Nv; ++j) {
-                dens[z][s] -= mycast<double>(g0_taui[j] * M_g0_tauj[j]);
+            }
+            for (int k = 0; k < K; ++k) {
+              D[z][k] = g0_minus0;
+            }
+
+            const int Nv = M_flavors[z].size2();
+            if (Nv == 0) {
+              continue;
+            }
+            const std::vector<itime_t> &op_times = submatrix_update->invA()[z].times();
+            const std::vector<site_t> &creator_sites = submatrix_update->invA()[z].creator_sites();
+            const std::vector<site_t> &annihilator_sites = submatrix_update->invA()[z].annihilator_sites();
+
+            //G0 between the operators and all the tau points, contracted with M in one GEMM
+            g0_L.resize(n_site * K, Nv);
+            g0_R.resize(Nv, n_site * K);
+            for (int k = 0; k < K; ++k) {
+              for (int i = 0; i < Nv; ++i) {
+                g0_intpl.interpolate_column(taus[k] - op_times[i], z, creator_sites[i], &g0_L(n_site * k, i));
               }
+              for (int j = 0; j < Nv; ++j) {
+                g0_intpl.interpolate_row(op_times[j] - taus[k], z, annihilator_sites[j], g0_row.data());
+                for (unsigned int s = 0; s < n_site; ++s) {
+                  g0_R(j, n_site * k + s) = g0_row[s];
+                }
+              }
+            }
+            M_g0_R.noalias() = M_flavors[z].block() * g0_R;
+            for (int k = 0; k < K; ++k) {
+              D[z][k].noalias() -= g0_L.block(n_site * k, 0, n_site, Nv) * M_g0_R.block(0, n_site * k, Nv, n_site);
             }
           }
+
+          //densities and equal-time density-density correlations from Wick's theorem averaged over the tau points
+          std::vector<std::vector<double> > dens(n_flavors, std::vector<double>(n_site, 0.0));
+          std::vector<double> ninj(n_site * n_site * n_flavors * n_flavors, 0.0);
+          for (int k = 0; k < K; ++k) {
+            for (unsigned int z = 0; z < n_flavors; ++z) {
+              for (unsigned int i = 0; i < n_site; ++i) {
+                dens[z][i] += std::real(D[z][k](i, i)) / K;
+              }
+            }
+            int pos = 0;
+            for (unsigned int flavor1 = 0; flavor1 < n_flavors; ++flavor1) {
+              for (unsigned int i = 0; i < n_site; ++i) {
+                for (unsigned int flavor2 = 0; flavor2 < n_flavors; ++flavor2) {
+                  for (unsigned int j = 0; j < n_site; ++j) {
+                    M_TYPE ninj_k = D[flavor1][k](i, i) * D[flavor2][k](j, j);
+                    if (flavor1 == flavor2) {
+                      //exchange term <c^dagger_i c_j> <c_i c^dagger_j>
+                      ninj_k += D[flavor1][k](j, i) * (static_cast<double>(i == j) - D[flavor1][k](i, j));
+                    }
+                    ninj[pos] += std::real(ninj_k) / K;
+                    ++pos;
+                  }
+                }
+              }
+            }
+          }
+
           std::vector<double> densities(n_flavors, 0.0);
           for (unsigned int z = 0; z < n_flavors; ++z) {
             std::vector<double> densmeas(n_site);
@@ -241,27 +506,321 @@ namespace alps {
                 signed_densmeas[i] *= sign_real;
               }
             }
-            measurements["densities_" + boost::lexical_cast<std::string>(z)] << sign_real * densmeas;
+            *densities_flavor_obs[z] << sign_real * densmeas;
             densities[z] /= n_site;
             densities[z] = densities[z];
           }
-          measurements["densities"] << sign_real * densities;
+          *densities_obs << sign_real * densities;
 
-          {
-            std::vector<double> ninj(n_site * n_site * n_flavors * n_flavors);
-            int pos = 0;
-            for (unsigned int flavor1 = 0; flavor1 < n_flavors; ++flavor1) {
-              for (unsigned int i = 0; i < n_site; ++i) {
-                for (unsigned int flavor2 = 0; flavor2 < n_flavors; ++flavor2) {
-                  for (unsigned int j = 0; j < n_site; ++j) {
-                    ninj[pos] = (dens[flavor1][i]) * (dens[flavor2][j]);
-                    ++pos;
+          *ninj_obs << sign_real * ninj;
+        }
+
+        /**
+         * Two-particle measurement in the particle-hole (ph) and particle-particle (pp) channels
+         *
+         * M is transformed to Matsubara frequencies with batched exponentials,
+         *   X_{ab}(nu_1, nu_2) = sum_{q in a, p in b} exp(i nu_1 tau_q) M_{qp} exp(-i nu_2 tau_p),
+         * and the four-point function is assembled from Wick's theorem for each configuration:
+         *   ph: X_{ab}(nu, nu+omega) X_{cd}(nu'+omega, nu') - delta_{z1,z2} X_{ad}(nu, nu') X_{cb}(nu'+omega, nu+omega)
+         *   pp: X_{ab}(nu, omega-nu') X_{cd}(omega-nu, nu') - delta_{z1,z2} X_{ad}(nu, nu') X_{cb}(omega-nu, omega-nu')
+         * with X of flavor z1 (z2) for the indices a, b (c, d).
+         * Only this M-space part <X X> - <X X> is accumulated (written to /G2_M by postprocess_G2);
+         * the full G2 is obtained by attaching G0 to the four legs and adding the disconnected parts.
+         *
+         * The flattened observable "G2" has the shape
+         * [channel][omega][z1][a][b][nu][z2][c][d][nu'][real/imag], where -n_G2_fermionic <= nu < n_G2_fermionic.
+         * In the ph channel, the direct term of each omega block with rows (z1, a, b, nu) and columns (z2, c, d, nu')
+         * is a single outer product. The bosonic frequencies are processed in parallel with OpenMP.
+         */
+        template<class TYPES>
+        void InteractionExpansion<TYPES>::measure_G2() {
+          typedef Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> complex_matrix_t;
+          typedef Eigen::Matrix<std::complex<double>, Eigen::Dynamic, 1> complex_vector_t;
+
+          const std::complex<double> sign = submatrix_update->sign();
+          const int Nf = n_G2_fermionic, Nb = n_G2_bosonic;
+          //fermionic frequencies nu_n = (2n+1) pi/beta with -Nf <= n < Nf + Nb
+          const int n_freq = 2 * Nf + Nb;
+
+          //Xw[z](a * n_freq + n1 + Nf, b * n_freq + n2 + Nf) = X_{ab}(nu_n1, nu_n2)
+          std::vector<complex_matrix_t> Xw(n_flavors);
+          complex_matrix_t exp_c, exp_a, M_exp_a;
+          for (unsigned int z = 0; z < n_flavors; ++z) {
+            Xw[z].setZero(n_site * n_freq, n_site * n_freq);
+            const int Nv = M_flavors[z].size2();
+            if (Nv == 0) {
+              continue;
+            }
+            const std::vector<itime_t> &op_times = submatrix_update->invA()[z].times();
+            const std::vector<site_t> &creator_sites = submatrix_update->invA()[z].creator_sites();
+            const std::vector<site_t> &annihilator_sites = submatrix_update->invA()[z].annihilator_sites();
+
+            exp_c.setZero(n_site * n_freq, Nv);
+            exp_a.setZero(Nv, n_site * n_freq);
+            for (int q = 0; q < Nv; ++q) {
+              const double x = M_PI * op_times[q] / beta;
+              const std::complex<double> step = std::polar(1.0, 2 * x);
+              std::complex<double> e = std::polar(1.0, (1 - 2 * Nf) * x);
+              for (int k = 0; k < n_freq; ++k) {
+                exp_c(creator_sites[q] * n_freq + k, q) = e;
+                e *= step;
+              }
+            }
+            for (int p = 0; p < Nv; ++p) {
+              const double x = M_PI * op_times[p] / beta;
+              const std::complex<double> step = std::polar(1.0, -2 * x);
+              std::complex<double> e = std::polar(1.0, -(1 - 2 * Nf) * x);
+              for (int k = 0; k < n_freq; ++k) {
+                exp_a(p, annihilator_sites[p] * n_freq + k) = e;
+                e *= step;
+              }
+            }
+            M_exp_a.noalias() = M_flavors[z].block() * exp_a;
+            Xw[z].noalias() = exp_c * M_exp_a;
+          }
+
+          //L = number of rows (columns) of a (channel, omega) block
+          const int L = n_flavors * n_site * n_site * 2 * Nf;
+          std::vector<double> G2_flat(2 * 2 * Nb * L * L);
+          const int n_site_ = n_site, n_flavors_ = n_flavors;
+          auto X = [&](int z, int a, int n1, int b, int n2) -> const std::complex<double> & {
+            return Xw[z](a * n_freq + n1 + Nf, b * n_freq + n2 + Nf);
+          };
+          auto row = [&](int z, int a, int b, int n) {
+            return ((z * n_site_ + a) * n_site_ + b) * 2 * Nf + n + Nf;
+          };
+
+#pragma omp parallel for
+          for (int m = 0; m < Nb; ++m) {
+            complex_vector_t u(L), v(L);
+            complex_matrix_t block(L, L);
+            for (int channel = 0; channel < 2; ++channel) {
+              if (channel == 0) {
+                //ph, direct term: outer product
+                for (int z = 0; z < n_flavors_; ++z) {
+                  for (int a = 0; a < n_site_; ++a) {
+                    for (int b = 0; b < n_site_; ++b) {
+                      for (int n = -Nf; n < Nf; ++n) {
+                        u[row(z, a, b, n)] = X(z, a, n, b, n + m);
+                        v[row(z, a, b, n)] = X(z, a, n + m, b, n);
+                      }
+                    }
+                  }
+                }
+                block.noalias() = u * v.transpose();
+              } else {
+                //pp, direct term
+                for (int z1 = 0; z1 < n_flavors_; ++z1) {
+                  for (int a = 0; a < n_site_; ++a) {
+                    for (int b = 0; b < n_site_; ++b) {
+                      for (int n = -Nf; n < Nf; ++n) {
+                        for (int z2 = 0; z2 < n_flavors_; ++z2) {
+                          for (int c = 0; c < n_site_; ++c) {
+                            for (int d = 0; d < n_site_; ++d) {
+                              for (int n2 = -Nf; n2 < Nf; ++n2) {
+                                block(row(z1, a, b, n), row(z2, c, d, n2)) =
+                                  X(z1, a, n, b, m - n2 - 1) * X(z2, c, m - n - 1, d, n2);
+                              }
+                            }
+                          }
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+
+              //exchange term
+              for (int z = 0; z < n_flavors_; ++z) {
+                for (int a = 0; a < n_site_; ++a) {
+                  for (int b = 0; b < n_site_; ++b) {
+                    for (int n = -Nf; n < Nf; ++n) {
+                      for (int c = 0; c < n_site_; ++c) {
+                        for (int d = 0; d < n_site_; ++d) {
+                          for (int n2 = -Nf; n2 < Nf; ++n2) {
+                            block(row(z, a, b, n), row(z, c, d, n2)) -= channel == 0 ?
+                              X(z, a, n, d, n2) * X(z, c, n2 + m, b, n + m) :
+                              X(z, a, n, d, n2) * X(z, c, m - n - 1, b, m - n2 - 1);
+                          }
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+
+              const std::size_t offset = 2 * (static_cast<std::size_t>(channel) * Nb + m) * L * L;
+              for (int i = 0; i < L; ++i) {
+                for (int j = 0; j < L; ++j) {
+                  const std::complex<double> ztmp = block(i, j) * sign;
+                  G2_flat[offset + 2 * (i * L + j)] = ztmp.real();
+                  G2_flat[offset + 2 * (i * L + j) + 1] = ztmp.imag();
+                }
+              }
+            }
+          }
+
+          *G2_obs << G2_flat;
+        }
+
+        /**
+         * Density-density correlation function chi_{z1 i, z2 j}(tau) = <n_{z1,i}(tau) n_{z2,j}(0)>
+         *
+         * For each configuration, Wick's theorem gives for t1 > t2
+         *   <n_i(t1) n_j(t2)> = D_ii(t1) D_jj(t2) - delta_{z1,z2} G_ij(t1, t2) G_ji(t2, t1),
+         * where G(t1, t2) = G0(t1 - t2) - sum_{qp} G0(t1 - tau_q) M_{qp} G0(tau_p - t2) and D(t) = G(t, t+0).
+         * The estimator is averaged over chi.n_reference_times equally spaced reference times t2 = t1 - tau.
+         * G0 between the operators and all the times is evaluated with the batched interpolator
+         * and contracted with M in one GEMM per flavor.
+         *
+         * The flattened observable "chi" has the shape [z1][i][z2][j][k], where k runs over
+         *  - the uniform grid tau_k = beta k/(chi.n_tau-1) if chi.n_legendre = 0, or
+         *  - the Legendre coefficients chi_l = sqrt(2l+1) int_0^beta d tau P_l(x(tau)) chi(tau) otherwise.
+         *    The integral is estimated from chi.n_tau stratified random tau points.
+         */
+        template<class TYPES>
+        void InteractionExpansion<TYPES>::measure_chi() {
+          typedef Eigen::Matrix<M_TYPE, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+
+          const double sign_real = mycast<double>(submatrix_update->sign());
+          const int N = chi_n_tau, R = chi_n_reference_times;
+          const bool legendre = chi_n_legendre > 0;
+          const double eps = 1E-10 * beta;
+
+          //tau points in (0, beta)
+          std::vector<double> taus(N);
+          for (int g = 0; g < N; ++g) {
+            taus[g] = legendre ? beta * (g + random()) / N : std::min(std::max(beta * g / (N - 1), eps), beta - eps);
+          }
+
+          //times t2_r (reference) and t1_{r,g} = t2_r + tau_g, ordered as t2_0, t1_{0,0}, ..., t1_{0,N-1}, t2_1, ...
+          const int n_times = R * (N + 1);
+          std::vector<double> times(n_times);
+          const double offset = random();
+          for (int r = 0; r < R; ++r) {
+            const double t2 = beta * (r + offset) / R;
+            times[r * (N + 1)] = t2;
+            for (int g = 0; g < N; ++g) {
+              times[r * (N + 1) + 1 + g] = t2 + taus[g];
+            }
+          }
+
+          //D[z](i, r * N + g) = D_ii(t1_{r,g}), D2[z](i, r) = D_ii(t2_r),
+          //G12[z][r * N + g] = G(t1_{r,g}, t2_r), G21[z][r * N + g] = G(t2_r, t1_{r,g})
+          std::vector<matrix_t> D1(n_flavors), D2(n_flavors);
+          std::vector<std::vector<matrix_t> > G12(n_flavors, std::vector<matrix_t>(R * N)), G21(G12);
+          matrix_t g0_L, g0_R, M_g0_R, LMR_t2, LMR_t1;
+          std::vector<M_TYPE> g0_row(n_site);
+          for (unsigned int z = 0; z < n_flavors; ++z) {
+            matrix_t g0_minus0(n_site, n_site);
+            std::vector<matrix_t> g0_tau(N, matrix_t(n_site, n_site)), g0_minus_tau(N, matrix_t(n_site, n_site));
+            for (unsigned int a = 0; a < n_site; ++a) {
+              for (unsigned int b = 0; b < n_site; ++b) {
+                g0_minus0(a, b) = mycast<M_TYPE>(g0_intpl(-eps, z, a, b));
+                for (int g = 0; g < N; ++g) {
+                  g0_tau[g](a, b) = mycast<M_TYPE>(g0_intpl(taus[g], z, a, b));
+                  g0_minus_tau[g](a, b) = mycast<M_TYPE>(g0_intpl(-taus[g], z, a, b));
+                }
+              }
+            }
+
+            D1[z].resize(n_site, R * N);
+            D2[z].resize(n_site, R);
+            for (int r = 0; r < R; ++r) {
+              D2[z].col(r) = g0_minus0.diagonal();
+              for (int g = 0; g < N; ++g) {
+                D1[z].col(r * N + g) = g0_minus0.diagonal();
+                G12[z][r * N + g] = g0_tau[g];
+                G21[z][r * N + g] = g0_minus_tau[g];
+              }
+            }
+
+            const int Nv = M_flavors[z].size2();
+            if (Nv == 0) {
+              continue;
+            }
+            const std::vector<itime_t> &op_times = submatrix_update->invA()[z].times();
+            const std::vector<site_t> &creator_sites = submatrix_update->invA()[z].creator_sites();
+            const std::vector<site_t> &annihilator_sites = submatrix_update->invA()[z].annihilator_sites();
+
+            g0_L.resize(n_site * n_times, Nv);
+            g0_R.resize(Nv, n_site * n_times);
+            for (int k = 0; k < n_times; ++k) {
+              for (int i = 0; i < Nv; ++i) {
+                g0_intpl.interpolate_column(times[k] - op_times[i], z, creator_sites[i], &g0_L(n_site * k, i));
+              }
+              for (int j = 0; j < Nv; ++j) {
+                g0_intpl.interpolate_row(op_times[j] - times[k], z, annihilator_sites[j], g0_row.data());
+                for (unsigned int s = 0; s < n_site; ++s) {
+                  g0_R(j, n_site * k + s) = g0_row[s];
+                }
+              }
+            }
+            M_g0_R.noalias() = M_flavors[z].block() * g0_R;
+
+            for (int r = 0; r < R; ++r) {
+              const int k2 = r * (N + 1), k1 = k2 + 1;
+              //G0(t1 - tau_q) M G0(tau_p - t2) for all g and G0(t2 - tau_q) M G0(tau_p - t1) for all g
+              LMR_t2.noalias() = g0_L.block(n_site * k1, 0, n_site * N, Nv) * M_g0_R.block(0, n_site * k2, Nv, n_site);
+              LMR_t1.noalias() = g0_L.block(n_site * k2, 0, n_site, Nv) * M_g0_R.block(0, n_site * k1, Nv, n_site * N);
+              D2[z].col(r) -= (g0_L.block(n_site * k2, 0, n_site, Nv) * M_g0_R.block(0, n_site * k2, Nv, n_site)).diagonal();
+              for (int g = 0; g < N; ++g) {
+                const int k = k1 + g;
+                D1[z].col(r * N + g) -=
+                  (g0_L.block(n_site * k, 0, n_site, Nv) * M_g0_R.block(0, n_site * k, Nv, n_site)).diagonal();
+                G12[z][r * N + g] -= LMR_t2.block(n_site * g, 0, n_site, n_site);
+                G21[z][r * N + g] -= LMR_t1.block(0, n_site * g, n_site, n_site);
+              }
+            }
+          }
+
+          //chi on the tau points averaged over the reference times
+          const int n_components = n_flavors * n_site * n_flavors * n_site;
+          std::vector<double> chi_tau(n_components * N, 0.0);
+          int pos = 0;
+          for (unsigned int flavor1 = 0; flavor1 < n_flavors; ++flavor1) {
+            for (unsigned int i = 0; i < n_site; ++i) {
+              for (unsigned int flavor2 = 0; flavor2 < n_flavors; ++flavor2) {
+                for (unsigned int j = 0; j < n_site; ++j) {
+                  for (int r = 0; r < R; ++r) {
+                    for (int g = 0; g < N; ++g) {
+                      M_TYPE chi_k = D1[flavor1](i, r * N + g) * D2[flavor2](j, r);
+                      if (flavor1 == flavor2) {
+                        chi_k -= G12[flavor1][r * N + g](i, j) * G21[flavor1][r * N + g](j, i);
+                      }
+                      chi_tau[pos * N + g] += sign_real * std::real(chi_k) / R;
+                    }
                   }
+                  ++pos;
                 }
               }
             }
-            measurements["n_i n_j"] << sign_real * ninj;
           }
+
+          if (!legendre) {
+            *chi_obs << chi_tau;
+            return;
+          }
+
+          //Legendre compression
+          std::vector<double> x_vals(N);
+          for (int g = 0; g < N; ++g) {
+            x_vals[g] = 2 * taus[g] / beta - 1;
+          }
+          boost::multi_array<double, 2> legendre_vals(boost::extents[chi_n_legendre][N]);
+          chi_legendre_transformer.compute_legendre(x_vals, legendre_vals);
+          const std::vector<double> &sqrt_vals = chi_legendre_transformer.get_sqrt_2l_1();
+          std::vector<double> chi_l(n_components * chi_n_legendre, 0.0);
+          for (int c = 0; c < n_components; ++c) {
+            for (int l = 0; l < chi_n_legendre; ++l) {
+              double sum = 0.0;
+              for (int g = 0; g < N; ++g) {
+                sum += legendre_vals[l][g] * chi_tau[c * N + g];
+              }
+              chi_l[c * chi_n_legendre + l] = sqrt_vals[l] * beta * sum / N;
+            }
+          }
+          *chi_obs << chi_l;
         }
     }
 }
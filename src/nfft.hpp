@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <stdexcept>
+#include <cassert>
+
+#include "fft.hpp"
+
+namespace alps {
+    namespace ctint {
+
+        /**
+         * Non-equispaced fast Fourier transform (type 1) by Gaussian gridding
+         * (Greengard and Lee, SIAM Rev. 46, 443 (2004))
+         *
+         * Computes F_d(n) = sum_j f_{d,j} exp(i n theta_j) for n = 0, ..., n_freq-1
+         * for n_data independent sets of values f_{d,j} sharing the points theta_j in [0, 2pi).
+         * Each point costs O(n_spread) and each transform O(N log N) with N ~ 4 n_freq.
+         * The default n_spread = 12 gives a relative accuracy of about 1e-12.
+         */
+        class NonEquispacedFourierTransform {
+        public:
+            NonEquispacedFourierTransform(int n_freq, int n_data, int n_spread = 12)
+              : n_freq_(n_freq),
+                n_data_(n_data),
+                n_spread_(n_spread) {
+              if (n_freq <= 0 || n_data <= 0 || n_spread <= 0) {
+                throw std::invalid_argument("NonEquispacedFourierTransform: arguments must be positive");
+              }
+              //oversampling ratio R = 2: the grid covers the frequencies -n_grid/4 <= n < n_grid/4
+              n_grid_ = 1;
+              while (n_grid_ < 4 * n_freq) {
+                n_grid_ *= 2;
+              }
+              const double R = 2.0, N = n_grid_ / R;
+              tau_ = M_PI * n_spread / (N * N * R * (R - 0.5));
+              h_ = 2 * M_PI / n_grid_;
+
+              E3_.resize(2 * n_spread + 1);
+              for (int k = -n_spread; k <= n_spread; ++k) {
+                E3_[k + n_spread] = std::exp(-(k * h_) * (k * h_) / (4 * tau_));
+              }
+              deconvolution_.resize(n_freq);
+              for (int n = 0; n < n_freq; ++n) {
+                deconvolution_[n] = std::sqrt(M_PI / tau_) * std::exp(n * n * tau_) / n_grid_;
+              }
+              grid_.resize(n_data * n_grid_);
+              weights_.resize(2 * n_spread + 1);
+              clear();
+            }
+
+            int n_freq() const {
+              return n_freq_;
+            }
+
+            int n_data() const {
+              return n_data_;
+            }
+
+            void clear() {
+              std::fill(grid_.begin(), grid_.end(), std::complex<double>(0.0, 0.0));
+            }
+
+            /**
+             * Spread values[i] (i = 0, ..., n_values-1) at the point theta onto the grids of data first_data + i
+             */
+            template<typename T>
+            void add(double theta, const T *values, int first_data, int n_values) {
+              assert(first_data >= 0 && first_data + n_values <= n_data_);
+              const int m0 = static_cast<int>(std::floor(theta / h_ + 0.5));
+              const double d = theta - m0 * h_;
+              //Gaussian weights exp(-(k h - d)^2/(4 tau)) = E1 * E2^k * E3[k]
+              const double E1 = std::exp(-d * d / (4 * tau_));
+              const double E2 = std::exp(d * h_ / (2 * tau_));
+              double E2k = E1 * std::pow(E2, -n_spread_);
+              for (int k = 0; k < 2 * n_spread_ + 1; ++k) {
+                weights_[k] = E2k * E3_[k];
+                E2k *= E2;
+              }
+              for (int k = -n_spread_; k <= n_spread_; ++k) {
+                const int m = ((m0 + k) % n_grid_ + n_grid_) % n_grid_;
+                const double w = weights_[k + n_spread_];
+                for (int i = 0; i < n_values; ++i) {
+                  grid_[(first_data + i) * n_grid_ + m] += w * values[i];
+                }
+              }
+            }
+
+            /**
+             * Compute F_d(n) for n = 0, ..., n_freq-1 from the values added since the last call of clear()
+             */
+            void transform(int i_data, std::vector<std::complex<double> > &result) const {
+              work_.assign(grid_.begin() + i_data * n_grid_, grid_.begin() + (i_data + 1) * n_grid_);
+              fft_radix2(work_, 1);
+              result.resize(n_freq_);
+              for (int n = 0; n < n_freq_; ++n) {
+                result[n] = work_[n] * deconvolution_[n];
+              }
+            }
+
+        private:
+            const int n_freq_, n_data_, n_spread_;
+            int n_grid_;
+            double tau_, h_;
+            std::vector<double> E3_, deconvolution_, weights_;
+            std::vector<std::complex<double> > grid_;
+            mutable std::vector<std::complex<double> > work_;
+        };
+    }
+}
@@ -4,48 +4,148 @@
 
 #pragma once
 
+#include <cmath>
 #include <complex>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <alps/accumulators.hpp>
 
 #include "legendre.h"
+#include "basis.hpp"
+#include "basis_rotation.hpp"
 #include "hdf5/boost_any.hpp"
 
 namespace alps {
     namespace ctint {
 
+        /**
+         * Mean and error of <x s>/<s> for the observable x accumulated with the sign s.
+         * The division of the ALPS results is done by jackknife over the bins of the full binning accumulators,
+         * which accounts for the correlation between x and the sign.
+         */
+        inline void divide_by_sign(const alps::accumulators::result_set &results, const std::string &name,
+                                   std::vector<double> &mean, std::vector<double> &error) {
+          const alps::accumulators::result_wrapper ratio = results[name] / results["Sign"];
+          mean = ratio.mean<std::vector<double> >();
+          error = ratio.error<std::vector<double> >();
+        }
+
+        /**
+         * Same as divide_by_sign for an observable accumulated with logarithmic binning (BinnedRealVectorObservable),
+         * whose bins are not kept for jackknife. The error is bounded from above by (err(x s) + |<x s>/<s>| err(s))/|<s>|,
+         * which holds for any correlation between x s and the sign and is exact without a sign problem.
+         */
+        inline void divide_by_sign_binned(const alps::accumulators::result_set &results, const std::string &name,
+                                          std::vector<double> &mean, std::vector<double> &error) {
+          const double sign = results["Sign"].mean<double>();
+          const double sign_error = results["Sign"].error<double>();
+          mean = results[name].mean<std::vector<double> >();
+          error = results[name].error<std::vector<double> >();
+          for (int i = 0; i < mean.size(); ++i) {
+            mean[i] /= sign;
+            error[i] = (error[i] + std::abs(mean[i]) * sign_error) / std::abs(sign);
+          }
+        }
+
+        /**
+         * Transform X[..][a][b][flavor] given in the basis d_a = sum_i V[flavor](i,a) c_i back to the original basis:
+         * X_{ij} = sum_{ab} V(i,a) X_{ab} V(j,b)
+         */
+        inline void rotate_back(const std::vector<Eigen::MatrixXd>& V, boost::multi_array<std::complex<double>,4>& X) {
+          const int n_points = X.shape()[0], n_site = X.shape()[1], n_flavors = X.shape()[3];
+          const boost::multi_array<std::complex<double>,4> X_rot(X);
+          for (int i_p = 0; i_p < n_points; ++i_p) {
+            for (int flavor = 0; flavor < n_flavors; ++flavor) {
+              for (int i = 0; i < n_site; ++i) {
+                for (int j = 0; j < n_site; ++j) {
+                  std::complex<double> sum = 0.0;
+                  for (int a = 0; a < n_site; ++a) {
+                    for (int b = 0; b < n_site; ++b) {
+                      sum += V[flavor](i, a) * X_rot[i_p][a][b][flavor] * V[flavor](j, b);
+                    }
+                  }
+                  X[i_p][i][j][flavor] = sum;
+                }
+              }
+            }
+          }
+        }
+
+        /**
+         * Same as rotate_back for the error bars of the real and imaginary parts (neglecting covariances)
+         */
+        inline void rotate_back_error(const std::vector<Eigen::MatrixXd>& V, boost::multi_array<std::complex<double>,4>& X_error) {
+          const int n_points = X_error.shape()[0], n_site = X_error.shape()[1], n_flavors = X_error.shape()[3];
+          const boost::multi_array<std::complex<double>,4> X_rot_error(X_error);
+          for (int i_p = 0; i_p < n_points; ++i_p) {
+            for (int flavor = 0; flavor < n_flavors; ++flavor) {
+              for (int i = 0; i < n_site; ++i) {
+                for (int j = 0; j < n_site; ++j) {
+                  double var_re = 0.0, var_im = 0.0;
+                  for (int a = 0; a < n_site; ++a) {
+                    for (int b = 0; b < n_site; ++b) {
+                      const double coeff = std::pow(V[flavor](i, a) * V[flavor](j, b), 2);
+                      var_re += coeff * std::pow(X_rot_error[i_p][a][b][flavor].real(), 2);
+                      var_im += coeff * std::pow(X_rot_error[i_p][a][b][flavor].imag(), 2);
+                    }
+                  }
+                  X_error[i_p][i][j][flavor] = std::complex<double>(std::sqrt(var_re), std::sqrt(var_im));
+                }
+              }
+            }
+          }
+        }
+
         template<class SOLVER_TYPE>
         void evaluate_selfenergy_measurement_legendre(const typename alps::accumulators::result_set &results,
                                                       const typename alps::params &parms,
+                                                      const BasisTransformer &basis,
                                                       boost::multi_array<std::complex<double>,4>& Sl,
+                                                      boost::multi_array<std::complex<double>,4>& Sl_error,
                                                       boost::multi_array<std::complex<double>,4>& Sw
         ) {
-          std::cout << "evaluating self energy measurement: lengendre, real space" << std::endl;
-          double sign = results["Sign"].template mean<double>();
+          std::cout << "evaluating self energy measurement: " << basis.name() << ", real space" << std::endl;
 
           int n_site = parms["model.sites"];
           int n_flavors = parms["model.spins"];
           int n_matsubara = parms["G1.n_matsubara"];
-          int n_legendre = parms["G1.n_legendre"];
+          int n_legendre = basis.size();
 
-          //Legendre expansion utils
-          LegendreTransformer legendre_transformer(n_matsubara, n_legendre);
-          auto &Tnl = legendre_transformer.Tnl();
+          //S(iomega_n) = sum_l Tnl(n, l) S_l
+          auto &Tnl = basis.Tnl();
 
           Sl.resize(boost::extents[n_legendre][n_site][n_site][n_flavors]);
           Sw.resize(boost::extents[n_matsubara][n_site][n_site][n_flavors]);
 
-          //load S_l
+          //load S_l: the flattened observable has the shape [flavor][site1][site2][l][real/imag]
+          std::vector<double> Sl_flat, Sl_flat_error;
+          divide_by_sign_binned(results, "Sl", Sl_flat, Sl_flat_error);
+          if (Sl_flat.size() != 2 * n_flavors * n_site * n_site * n_legendre) {
+            throw std::runtime_error("The size of the measured Sl does not match model.spins, model.sites and the size of the basis");
+          }
           for (int flavor1 = 0; flavor1 < n_flavors; ++flavor1) {
             for (int site1 = 0; site1 < n_site; ++site1) {
               for (int site2 = 0; site2 < n_site; ++site2) {
-                std::stringstream Sl_real_name, Sl_imag_name;
-                Sl_real_name << "Sl_real_" << flavor1 << "_" << site1 << "_" << site2;
-                Sl_imag_name << "Sl_imag_" << flavor1 << "_" << site1 << "_" << site2;
-                std::vector<double> mean_real = results[Sl_real_name.str().c_str()].template mean<std::vector<double> >();
-                std::vector<double> mean_imag = results[Sl_imag_name.str().c_str()].template mean<std::vector<double> >();
                 for (unsigned int i_l = 0; i_l < n_legendre; ++i_l) {
-                  Sl[i_l][site1][site2][flavor1] = std::complex<double>(mean_real[i_l], mean_imag[i_l]) / sign;
+                  const std::size_t idx = ((flavor1 * n_site + site1) * n_site + site2) * n_legendre + i_l;
+                  Sl[i_l][site1][site2][flavor1] = std::complex<double>(Sl_flat[2 * idx], Sl_flat[2 * idx + 1]);
+                }
+              }
+            }
+          }
+
+          //error bars: the real (imaginary) part of Sl_error is the error of the real (imaginary) part of Sl
+          {
+            Sl_error.resize(boost::extents[n_legendre][n_site][n_site][n_flavors]);
+            for (int flavor1 = 0; flavor1 < n_flavors; ++flavor1) {
+              for (int site1 = 0; site1 < n_site; ++site1) {
+                for (int site2 = 0; site2 < n_site; ++site2) {
+                  for (unsigned int i_l = 0; i_l < n_legendre; ++i_l) {
+                    const std::size_t idx = ((flavor1 * n_site + site1) * n_site + site2) * n_legendre + i_l;
+                    Sl_error[i_l][site1][site2][flavor1] = std::complex<double>(Sl_flat_error[2 * idx], Sl_flat_error[2 * idx + 1]);
+                  }
                 }
               }
             }
@@ -70,24 +170,125 @@ namespace alps {
           }
         }
 
+        template<class SOLVER_TYPE>
+        void evaluate_selfenergy_measurement_matsubara(const typename alps::accumulators::result_set &results,
+                                                       const typename alps::params &parms,
+                                                       boost::multi_array<std::complex<double>,4>& Sw
+        ) {
+          std::cout << "evaluating self energy measurement: matsubara, real space" << std::endl;
+          double sign = results["Sign"].template mean<double>();
+
+          int n_site = parms["model.sites"];
+          int n_flavors = parms["model.spins"];
+          int n_matsubara = parms["G1.n_matsubara"];
+
+          //the flattened observable has the shape [flavor][site1][site2][n][real/imag]
+          std::vector<double> Sw_flat = results["Sw"].template mean<std::vector<double> >();
+          if (Sw_flat.size() != 2 * n_flavors * n_site * n_site * n_matsubara) {
+            throw std::runtime_error("The size of the measured Sw does not match model.spins, model.sites and G1.n_matsubara");
+          }
+          Sw.resize(boost::extents[n_matsubara][n_site][n_site][n_flavors]);
+          for (int flavor1 = 0; flavor1 < n_flavors; ++flavor1) {
+            for (int site1 = 0; site1 < n_site; ++site1) {
+              for (int site2 = 0; site2 < n_site; ++site2) {
+                for (int n = 0; n < n_matsubara; ++n) {
+                  const std::size_t idx = ((flavor1 * n_site + site1) * n_site + site2) * n_matsubara + n;
+                  Sw[n][site1][site2][flavor1] = std::complex<double>(Sw_flat[2 * idx], Sw_flat[2 * idx + 1]) / sign;
+                }
+              }
+            }
+          }
+        }
+
+        /**
+         * Writes the two-particle quantity accumulated by measure_G2 to /G2_M/ph and /G2_M/pp (errors in /G2_M/ph_error
+         * and /G2_M/pp_error, the real (imaginary) part being the error of the real (imaginary) part).
+         * This is <X X> - <X X> of the Fourier transformed M divided by beta, i.e. the G2 before attaching G0 to the four
+         * legs and without the disconnected parts; it is not the full two-particle Green's function.
+         * The shape is [omega][z1][a][b][nu][z2][c][d][nu'] with -n_fermionic <= nu, nu' < n_fermionic.
+         */
+        template<class SOLVER_TYPE>
+        void postprocess_G2(const typename alps::accumulators::result_set &results,
+                            const typename alps::params &parms, alps::hdf5::archive& ar) {
+          std::cout << "evaluating two-particle measurement" << std::endl;
+          const double beta = parms["model.beta"];
+
+          const int n_site = parms["model.sites"];
+          const int n_flavors = parms["model.spins"];
+          const int n_fermionic = parms["G2.n_fermionic"];
+          const int n_bosonic = parms["G2.n_bosonic"];
+
+          //the flattened observable has the shape [channel][omega][z1][a][b][nu][z2][c][d][nu'][real/imag]
+          std::vector<double> G2_flat, G2_flat_error;
+          divide_by_sign(results, "G2", G2_flat, G2_flat_error);
+          typedef boost::multi_array<std::complex<double>, 9> G2_t;
+          G2_t G2_ph(boost::extents[n_bosonic][n_flavors][n_site][n_site][2 * n_fermionic]
+                       [n_flavors][n_site][n_site][2 * n_fermionic]);
+          G2_t G2_pp(G2_ph), G2_ph_error(G2_ph), G2_pp_error(G2_ph);
+          if (G2_flat.size() != 4 * G2_ph.num_elements()) {
+            throw std::runtime_error("The size of the measured G2 does not match the parameters");
+          }
+          const std::size_t offset = 2 * G2_ph.num_elements();
+          for (std::size_t i = 0; i < G2_ph.num_elements(); ++i) {
+            G2_ph.origin()[i] = std::complex<double>(G2_flat[2 * i], G2_flat[2 * i + 1]) / beta;
+            G2_ph_error.origin()[i] = std::complex<double>(G2_flat_error[2 * i], G2_flat_error[2 * i + 1]) / beta;
+            G2_pp.origin()[i] = std::complex<double>(G2_flat[offset + 2 * i], G2_flat[offset + 2 * i + 1]) / beta;
+            G2_pp_error.origin()[i] =
+              std::complex<double>(G2_flat_error[offset + 2 * i], G2_flat_error[offset + 2 * i + 1]) / beta;
+          }
+          ar["/G2_M/ph"] = G2_ph;
+          ar["/G2_M/ph_error"] = G2_ph_error;
+          ar["/G2_M/pp"] = G2_pp;
+          ar["/G2_M/pp_error"] = G2_pp_error;
+        }
+
+        template<class SOLVER_TYPE>
+        void postprocess_chi(const typename alps::accumulators::result_set &results,
+                             const typename alps::params &parms, alps::hdf5::archive& ar) {
+          const double sign = results["Sign"].template mean<double>();
+
+          const int n_site = parms["model.sites"];
+          const int n_flavors = parms["model.spins"];
+          const int n_legendre = parms["chi.n_legendre"];
+          const int n_points = n_legendre > 0 ? n_legendre : parms["chi.n_tau"].template as<int>();
+
+          std::vector<double> chi_flatten = results["chi"].template mean<std::vector<double> >();
+          boost::multi_array<double,5> chi(boost::extents[n_flavors][n_site][n_flavors][n_site][n_points]);
+          if (chi_flatten.size() != chi.num_elements()) {
+            throw std::runtime_error("The size of the measured chi does not match the parameters");
+          }
+          std::transform(chi_flatten.begin(), chi_flatten.end(), chi.origin(), [&](double x){return x/sign;});
+          if (n_legendre > 0) {
+            ar["/chi_legendre"] = chi;
+          } else {
+            ar["/chi_tau"] = chi;
+          }
+        }
+
         template<class SOLVER_TYPE>
         void postprocess_densities(const typename alps::accumulators::result_set &results,
                                                       const typename alps::params &parms, alps::hdf5::archive& ar) {
           std::cout << "evaluating self energy measurement: lengendre, real space" << std::endl;
-          double sign = results["Sign"].template mean<double>();
 
           int n_site = parms["model.sites"];
           int n_flavors = parms["model.spins"];
 
-          auto divide_by_sign =  [&](double x){return x/sign;};
-          std::vector<double> densities = results["densities"].template mean<std::vector<double> >();
-          std::transform(densities.begin(), densities.end(), densities.begin(), divide_by_sign);
+          std::vector<double> densities, densities_error;
+          divide_by_sign(results, "densities", densities, densities_error);
           ar["/densities"] = densities;
+          ar["/densities_error"] = densities_error;
 
-          std::vector<double> ni_nj_flatten = results["n_i n_j"].template mean<std::vector<double> >();
+          std::vector<double> ni_nj_flatten, ni_nj_error_flatten;
+          divide_by_sign_binned(results, "n_i n_j", ni_nj_flatten, ni_nj_error_flatten);
           boost::multi_array<double,4> ni_nj(boost::extents[n_flavors][n_site][n_flavors][n_site]);
-          std::transform(ni_nj_flatten.begin(), ni_nj_flatten.end(), ni_nj.origin(), divide_by_sign);
+          boost::multi_array<double,4> ni_nj_error(boost::extents[n_flavors][n_site][n_flavors][n_site]);
+          if (ni_nj_flatten.size() != ni_nj.num_elements()) {
+            throw std::runtime_error("The size of the measured n_i n_j does not match model.spins and model.sites");
+          }
+          std::copy(ni_nj_flatten.begin(), ni_nj_flatten.end(), ni_nj.origin());
+          std::copy(ni_nj_error_flatten.begin(), ni_nj_error_flatten.end(), ni_nj_error.origin());
           ar["/ni_nj"] = ni_nj;
+          ar["/ni_nj_error"] = ni_nj_error;
         }
 
         template<class SOLVER_TYPE>
@@ -109,16 +310,73 @@ namespace alps {
 
           alps::hdf5::archive ar(output_file, "a");
 
+          /* Single-particle basis used in the simulation: d_a = sum_i V[flavor](i,a) c_i */
+          const bool basis_rotation = parms["model.basis_rotation"].template as<bool>();
+          const std::vector<Eigen::MatrixXd> V = make_basis_rotation(parms);
+          if (basis_rotation) {
+            const int n_site = parms["model.sites"];
+            boost::multi_array<double,3> V_out(boost::extents[n_flavors][n_site][n_site]);
+            for (int flavor = 0; flavor < n_flavors; ++flavor) {
+              for (int i = 0; i < n_site; ++i) {
+                for (int a = 0; a < n_site; ++a) {
+                  V_out[flavor][i][a] = V[flavor](i, a);
+                }
+              }
+            }
+            ar["/basis_rotation"] = V_out;
+          }
+
           /*  Single-particle Green's function */
-          boost::multi_array<std::complex<double>,4> Sl, Sw;
-          evaluate_selfenergy_measurement_legendre<SOLVER_TYPE>(results, parms, Sl, Sw);
+          //the basis is rebuilt from the parameters exactly as in the simulation
+          boost::shared_ptr<BasisTransformer> basis = make_G1_basis(parms);
+          boost::multi_array<std::complex<double>,4> Sl, Sl_error, Sw;
+          evaluate_selfenergy_measurement_legendre<SOLVER_TYPE>(results, parms, *basis, Sl, Sl_error, Sw);
+          if (basis_rotation) {
+            rotate_back(V, Sl);
+            rotate_back_error(V, Sl_error);
+            rotate_back(V, Sw);
+          }
           ar["Sign"] = results["Sign"].template mean<double>();
-          ar["/SigmaG_legendre"] = Sl;
+          ar["/Sign_error"] = results["Sign"].template error<double>();
+          ar["/SigmaG_" + basis->name()] = Sl;
+          ar["/SigmaG_" + basis->name() + "_error"] = Sl_error;
           ar["/SigmaG_omega"] = Sw;
 
+          /* Sigma G measured directly in Matsubara frequencies */
+          if (parms["G1.direct_matsubara"].template as<bool>()) {
+            evaluate_selfenergy_measurement_matsubara<SOLVER_TYPE>(results, parms, Sw);
+            if (basis_rotation) {
+              rotate_back(V, Sw);
+            }
+            ar["/SigmaG_omega_direct"] = Sw;
+          }
+
+          /* Two-particle Green's function */
+          if (parms["G2.measure"].template as<bool>()) {
+            postprocess_G2<SOLVER_TYPE>(results, parms, ar);
+          }
+
+          /* Density-density correlation function in imaginary time */
+          if (parms["chi.measure"].template as<bool>()) {
+            postprocess_chi<SOLVER_TYPE>(results, parms, ar);
+          }
+
           /* Density and density correlations */
           postprocess_densities<SOLVER_TYPE>(results, parms, ar);
 
+          /* Thermalization */
+          if (results["ThermalizationSteps"].count() > 0) {
+            const double thermalization_steps = results["ThermalizationSteps"].template mean<double>();
+            std::cout << "average number of thermalization steps was: " << thermalization_steps << std::endl;
+            ar["/thermalization_steps"] = thermalization_steps;
+          }
+
+          /* Autocorrelation times (in units of measurement_period steps) of the observables accumulated with binning */
+          ar["/autocorrelation/Sign"] = results["Sign"].template autocorrelation<double>();
+          ar["/autocorrelation/Sl"] = results["Sl"].template autocorrelation<std::vector<double> >();
+          ar["/autocorrelation/densities"] = results["densities"].template autocorrelation<std::vector<double> >();
+          ar["/autocorrelation/ni_nj"] = results["n_i n_j"].template autocorrelation<std::vector<double> >();
+
           /* Timings */
           std::vector<double> timings = results["Timings"].template mean<std::vector<double> >();
           std::cout << std::endl << "#### Timing analysis ####" << std::endl;
@@ -130,6 +388,23 @@ namespace alps {
                     << " Measurement: "  << timings[3] << " ms" << std::endl
                     << std::endl;
           //std::cout << "If the latter dominates, please increase the value of measurement_period." << std::endl << std::endl;
+
+          /* Statistical efficiency */
+          if (results["AutocorrelationTime"].count() > 0) {
+            const std::vector<std::string> names = SOLVER_TYPE::monitored_observable_names(basis->size());
+            std::vector<double> tau_int = results["AutocorrelationTime"].template mean<std::vector<double> >();
+            std::vector<double> samples_per_second = results["EffectiveSamplesPerSecond"].template mean<std::vector<double> >();
+            std::cout << "#### Statistical efficiency ####" << std::endl;
+            std::cout << "Integrated autocorrelation time tau_int = sum_{k>=1} rho(k) (in units of measurement_period steps, "
+                      << "0 for uncorrelated samples, errors are enhanced by sqrt(1+2 tau_int)) "
+                      << "and effective number of independent samples per second per process" << std::endl;
+            for (int i = 0; i < names.size(); ++i) {
+              std::cout << " " << names[i] << ": " << tau_int[i] << " , " << samples_per_second[i] << std::endl;
+            }
+            std::cout << std::endl;
+            ar["/autocorrelation_time"] = tau_int;
+            ar["/effective_samples_per_second"] = samples_per_second;
+          }
         }
     }
 }
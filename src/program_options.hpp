@@ -9,17 +9,22 @@ namespace alps {
           parms.description("Continous-time interaction expansion impurity solver");
           parms.define<long>("total_steps", 0, "Number of Monte Carlo sweeps");
           parms.define<std::size_t>("timelimit", 0, "Total simulation time (in units of second). 0 means \"indefinitely\"");
-          parms.define<long>("thermalization_steps", 0, "Number of thermalization steps");
+          parms.define<double>("error_target", 0.0, "Stop the simulation when the relative errors of the sign and the leading Legendre coefficients of Sl are below this value (checked only after each process has accumulated enough samples for a reliable binning analysis). 0 means \"never\"");
+          parms.define<long>("thermalization_steps", 0, "Number of thermalization steps (upper bound if thermalization.auto is on)");
+          parms.define<bool>("thermalization.auto", false, "Stop thermalization automatically once perturbation orders and sign become stationary");
+          parms.define<int>("thermalization.min_samples", 100, "Minimum number of samples (one per measurement_period steps) before testing stationarity");
+          parms.define<double>("thermalization.tolerance", 2.0, "Maximum difference in units of the standard error between the two halves of the thermalization history");
           parms.define<int>("measurement_period", -1, "Interval between measurements");
           parms.define<std::string>("outputfile", alps::fs::remove_extensions(origin_name(parms)) + ".out.h5", "name of the output file");
 
           //model
           parms.define<int>("model.sites", "Number of sites");
           parms.define<int>("model.spins", "Number of spins per site");//internally, model.spins is denoted by "flavors".
-          parms.define<std::string>("model.U_matrix_file", "Text file containing a list of interaction terms");
+          parms.define<std::string>("model.U_matrix_file", "File containing a list of interaction terms (text, or binary created by ctint_convert_U_matrix)");
           parms.define<double>("model.U", "onsite U");
           parms.define<std::string>("model.G0_tau_file", "", "Text file containing non-interacting Green's function");
           parms.define<double>("model.beta", "Inverse temperature");
+          parms.define<bool>("model.basis_rotation", false, "Simulate in the single-particle basis that approximately diagonalizes G0(tau) for each spin (may reduce the sign problem). Sigma G is rotated back to the original basis in postprocessing; densities, n_i n_j, chi and G2 are given in the rotated basis stored in /basis_rotation.");
 
           //update
           parms.define<int>("update.max_order", 10240, "Max perturbation order");
@@ -28,12 +33,39 @@ namespace alps {
           parms.define<double>("update.vertex_shift_step_size", 0.1, "Step size for shift updates in units of beta");
           parms.define<int>("update.n_spin_flip", 1, "How many spin flip updates are performed at each MC step");
           parms.define<int>("update.k_ins_max", 100, "Batch size for submatrix update: k^ins_max in PRB 89, 195146 (2014)");
-          parms.define<int>("update.n_multi_vertex_update", 1, "????? ");
+          parms.define<int>("update.n_multi_vertex_update", 1, "Maximum number of vertices inserted or removed at once (1: single-vertex updates, 2: double-vertex updates of non-density-type vertices in addition, which reduce the autocorrelation time substantially when such vertices are present)");
+          parms.define<double>("update.double_vertex_update_A", 1.0, "Decay rate a of the distribution exp(-a tau) + exp(-a (beta-tau)) + b of the distance tau between two vertices proposed in a double-vertex update");
+          parms.define<double>("update.double_vertex_update_B", 0.1, "Constant b of the distribution exp(-a tau) + exp(-a (beta-tau)) + b of the distance tau between two vertices proposed in a double-vertex update");
+          parms.define<bool>("update.importance_sampling_U", false, "Propose vertex types in single-vertex insertions with probability proportional to |U| (Walker's alias table) instead of uniformly");
           parms.define<int>("update.n_tau_statistics", 100, "Number of tau points for statistics");
+          parms.define<bool>("update.tune_proposals", true, "Tune the shift step size and update.double_vertex_update_A/B during thermalization. They are fixed in measurement steps.");
+          parms.define<double>("update.vertex_shift_target_acceptance", 0.5, "Target acceptance rate of shift updates used in tuning the step size");
+          parms.define<std::string>("update.alpha_pilot_scales", "", "Space-separated candidate factors for the shifts of alpha from 0 or 1 (delta for model.U). If given, each candidate is tried in a pilot phase before thermalization and the one with the lowest estimated cost per effective sample is used.");
+          parms.define<long>("update.alpha_pilot_steps", 1000, "Number of Monte Carlo steps per candidate in the pilot phase for alpha (the first half is discarded)");
+
+          //replica exchange
+          parms.define<int>("replica_exchange.n_replicas", 1, "Number of replicas with different scales of the interaction (1 means no replica exchange). The number of processes must be a multiple of this value.");
+          parms.define<double>("replica_exchange.U_scale_min", 0.5, "Smallest scale of the interaction in the ladder of replicas");
+          parms.define<int>("replica_exchange.period", 1, "Interval between replica exchanges in units of measurement_period steps");
 
           //Measurement
+          parms.define<std::string>("G1.basis", "legendre", "Basis for measuring Sigma G in imaginary time: legendre or ir (intermediate representation)");
           parms.define<int>("G1.n_legendre", 200, "Number of Legendre polynomials");
+          parms.define<double>("G1.ir_lambda", 1000.0, "Dimensionless cutoff beta*omega_max of the IR basis");
+          parms.define<double>("G1.ir_sv_cutoff", 1e-8, "IR basis functions with relative singular values above this value are used (values below about 1e-10 are not resolved in double precision)");
           parms.define<int>("G1.n_matsubara", 1024, "Number of Matsubara frequencies");
+          parms.define<bool>("G1.direct_matsubara", false, "Measure Sigma G at the first G1.n_matsubara Matsubara frequencies directly by non-equispaced FFT in addition to the G1 basis measurement");
+          parms.define<int>("G1.n_tau_densities", 16, "Number of equally spaced imaginary times over which densities and density-density correlations are averaged in each measurement");
+          parms.define<int>("G1.n_time_shifts", -1, "Number of random time shifts of the configuration in the measurement of Sl (-1: the expansion order, 0: chosen adaptively after pilot measurements)");
+
+          parms.define<bool>("G2.measure", false, "Measure the M-space part of the two-particle Green's function in the particle-hole and particle-particle channels (written to /G2_M: the Wick contractions of the Fourier transformed M divided by beta, without the G0 legs and the disconnected parts)");
+          parms.define<int>("G2.n_fermionic", 10, "Number of non-negative fermionic frequencies for G2 (-n_fermionic <= n < n_fermionic are measured)");
+          parms.define<int>("G2.n_bosonic", 1, "Number of non-negative bosonic frequencies for G2");
+
+          parms.define<bool>("chi.measure", false, "Measure the density-density correlation function <n_i(tau) n_j(0)>");
+          parms.define<int>("chi.n_tau", 101, "Number of tau points in [0, beta] for the density-density correlation function");
+          parms.define<int>("chi.n_legendre", 0, "If positive, chi.n_tau random tau points are used to measure this number of Legendre coefficients of the density-density correlation function instead of its values on the tau grid");
+          parms.define<int>("chi.n_reference_times", 4, "Number of equally spaced reference times over which the density-density correlation function is averaged in each measurement");
 
           //parms.define<int>("MAX_TIME", 86400, "Max simulation time in units of second");
 
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+#include <mpi.h>
+#include <alps/mpi.hpp>
+
+#include "U_matrix.h"
+
+namespace alps {
+    namespace ctint {
+
+        /**
+         * Replica exchange (parallel tempering) in the scale of the interaction
+         *
+         * The processes are divided into groups of n_replicas consecutive ranks.
+         * The r-th replica of each group samples configurations with the weight U_scale_r^n W(C),
+         * where n is the number of vertices and U_scale_r = U_scale_min^{(n_replicas-1-r)/(n_replicas-1)}.
+         * The last replica of each group (U_scale=1) samples the physical distribution.
+         * Configurations of neighboring replicas a and b are swapped with the probability
+         * min(1, (U_scale_a/U_scale_b)^{n_b-n_a}).
+         */
+        class ReplicaExchange {
+        public:
+            ReplicaExchange(const alps::mpi::communicator &comm, int n_replicas, double U_scale_min, int period)
+              : comm_(comm),
+                n_replicas_(n_replicas),
+                replica_(comm.rank() % n_replicas),
+                period_(period),
+                U_scales_(n_replicas, 1.0),
+                num_calls_(0),
+                num_exchanges_(0),
+                num_attempted_(0),
+                num_accepted_(0) {
+              if (n_replicas < 1) {
+                throw std::runtime_error("replica_exchange.n_replicas must be positive");
+              }
+              if (comm.size() % n_replicas != 0) {
+                throw std::runtime_error("The number of processes must be a multiple of replica_exchange.n_replicas");
+              }
+              if (n_replicas > 1 && (U_scale_min <= 0.0 || U_scale_min >= 1.0)) {
+                throw std::runtime_error("replica_exchange.U_scale_min must be in (0, 1)");
+              }
+              if (period < 1) {
+                throw std::runtime_error("replica_exchange.period must be positive");
+              }
+              for (int r = 0; r < n_replicas - 1; ++r) {
+                U_scales_[r] = std::pow(U_scale_min, (n_replicas - 1.0 - r) / (n_replicas - 1.0));
+              }
+            }
+
+            bool enabled() const {
+              return n_replicas_ > 1;
+            }
+
+            int period() const {
+              return period_;
+            }
+
+            double U_scale() const {
+              return U_scales_[replica_];
+            }
+
+            const std::vector<double> &U_scales() const {
+              return U_scales_;
+            }
+
+            /**
+             * Return true if this replica samples the physical distribution (U_scale=1)
+             */
+            bool is_physical() const {
+              return replica_ == n_replicas_ - 1;
+            }
+
+            long num_attempted() const {
+              return num_attempted_;
+            }
+
+            long num_accepted() const {
+              return num_accepted_;
+            }
+
+            /**
+             * Try to swap the configuration with a neighboring replica.
+             * This must be called by all processes the same number of times.
+             * Exchanges are attempted every "period" calls.
+             * Return true if itime_vertices have been replaced by the configuration of the partner.
+             */
+            template<typename T, typename R>
+            bool exchange(const general_U_matrix<T> &Uijkl, itime_vertex_container &itime_vertices, R &random01) {
+              if (!enabled() || ++num_calls_ % period_ != 0) {
+                return false;
+              }
+
+              //pairs (r, r+1) with r = num_exchanges_ mod 2
+              const int offset = num_exchanges_ % 2;
+              ++num_exchanges_;
+              const int partner = (replica_ - offset) % 2 == 0 ? replica_ + 1 : replica_ - 1;
+              if (partner < 0 || partner >= n_replicas_) {
+                return false;
+              }
+              const int partner_rank = comm_.rank() + partner - replica_;
+              const bool is_lower = partner > replica_;
+
+              std::vector<double> send_buffer;
+              for (itime_vertex_container::const_iterator it = itime_vertices.begin(); it != itime_vertices.end(); ++it) {
+                if (it->is_non_interacting()) {
+                  continue;
+                }
+                send_buffer.push_back(it->type());
+                send_buffer.push_back(it->af_state());
+                send_buffer.push_back(it->time());
+              }
+              int n_send = send_buffer.size() / 3, n_recv;
+              MPI_Sendrecv(&n_send, 1, MPI_INT, partner_rank, 0,
+                           &n_recv, 1, MPI_INT, partner_rank, 0,
+                           comm_, MPI_STATUS_IGNORE);
+
+              //the lower replica makes the decision
+              int accepted;
+              if (is_lower) {
+                const double prob = std::pow(U_scales_[replica_] / U_scales_[partner], n_recv - n_send);
+                accepted = random01() < prob ? 1 : 0;
+                MPI_Send(&accepted, 1, MPI_INT, partner_rank, 1, comm_);
+              } else {
+                MPI_Recv(&accepted, 1, MPI_INT, partner_rank, 1, comm_, MPI_STATUS_IGNORE);
+              }
+              ++num_attempted_;
+              if (!accepted) {
+                return false;
+              }
+              ++num_accepted_;
+
+              std::vector<double> recv_buffer(3 * n_recv);
+              MPI_Sendrecv(send_buffer.data(), 3 * n_send, MPI_DOUBLE, partner_rank, 2,
+                           recv_buffer.data(), 3 * n_recv, MPI_DOUBLE, partner_rank, 2,
+                           comm_, MPI_STATUS_IGNORE);
+
+              itime_vertices.clear();
+              for (int iv = 0; iv < n_recv; ++iv) {
+                const int type = static_cast<int>(recv_buffer[3 * iv]);
+                const vertex_definition<T> &vdef = Uijkl.get_vertex(type);
+                itime_vertices.push_back(
+                  itime_vertex(type, static_cast<int>(recv_buffer[3 * iv + 1]), recv_buffer[3 * iv + 2],
+                               vdef.is_density_type())
+                );
+              }
+              return true;
+            }
+
+        private:
+            alps::mpi::communicator comm_;
+            const int n_replicas_, replica_, period_;
+            std::vector<double> U_scales_;
+            long num_calls_, num_exchanges_, num_attempted_, num_accepted_;
+        };
+    }
+}
@@ -10,9 +10,11 @@
 
 #include <boost/lambda/lambda.hpp>
 #include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "operator.hpp"
 #include "U_matrix.h"
+#include "green_function.h"
 #include "fastupdate_formula.h"
 
 namespace alps {
@@ -39,6 +41,76 @@ namespace alps {
           return (f1-f2)/f2;
         }
 
+        /*
+         * G0 between num annihilators given as arrays (flavor of cdagger, sites[i], times[i], small_indices[i]) and a creator.
+         * Interpolators providing interpolate_annihilators() (green_function and G0Interpolator) evaluate them in a batch.
+         * Others are called element by element.
+         */
+        template<typename SPLINE_G0_TYPE, typename S>
+        void eval_G0_annihilators(const SPLINE_G0_TYPE& spline_G0, const creator& cdagger, const itime_t* times,
+                                  const int* small_indices, const site_t* sites, int num, S* values) {
+          for (int i=0; i<num; ++i) {
+            values[i] = spline_G0(annihilator(cdagger.flavor(), sites[i], operator_time(times[i], small_indices[i])), cdagger);
+          }
+        }
+
+        template<typename T, typename S>
+        void eval_G0_annihilators(const green_function<T>& spline_G0, const creator& cdagger, const itime_t* times,
+                                  const int* small_indices, const site_t* sites, int num, S* values) {
+          spline_G0.interpolate_annihilators(cdagger, times, small_indices, sites, num, values);
+        }
+
+        /*
+         * Type-erased interpolator of G0 held by SubmatrixUpdate.
+         * The batched evaluation of green_function is kept, so that the hot fills of G0 in InvAMatrix do not construct
+         * operator objects for each element.
+         */
+        template<typename T>
+        class G0Interpolator {
+        public:
+            typedef boost::function<void(const creator&, const itime_t*, const int*, const site_t*, int, T*)> batch_type;
+
+            template<typename G0>
+            G0Interpolator(const G0& g0) : single_(g0) {
+              const boost::function<T(const annihilator&,const creator&)> single(single_);
+              batch_ = [single](const creator& cdagger, const itime_t* times, const int* small_indices, const site_t* sites,
+                                int num, T* values) {
+                eval_G0_annihilators(single, cdagger, times, small_indices, sites, num, values);
+              };
+            }
+
+            template<typename S>
+            G0Interpolator(const green_function<S>& g0) {
+              boost::shared_ptr<const green_function<S> > p_g0(new green_function<S>(g0));
+              single_ = [p_g0](const annihilator& c, const creator& cdagger) {
+                return mycast<T>((*p_g0)(c, cdagger));
+              };
+              batch_ = [p_g0](const creator& cdagger, const itime_t* times, const int* small_indices, const site_t* sites,
+                              int num, T* values) {
+                p_g0->interpolate_annihilators(cdagger, times, small_indices, sites, num, values);
+              };
+            }
+
+            T operator()(const annihilator& c, const creator& cdagger) const {
+              return single_(c, cdagger);
+            }
+
+            void interpolate_annihilators(const creator& cdagger, const itime_t* times, const int* small_indices,
+                                          const site_t* sites, int num, T* values) const {
+              batch_(cdagger, times, small_indices, sites, num, values);
+            }
+
+        private:
+            boost::function<T(const annihilator&,const creator&)> single_;
+            batch_type batch_;
+        };
+
+        template<typename T>
+        void eval_G0_annihilators(const G0Interpolator<T>& spline_G0, const creator& cdagger, const itime_t* times,
+                                  const int* small_indices, const site_t* sites, int num, T* values) {
+          spline_G0.interpolate_annihilators(cdagger, times, small_indices, sites, num, values);
+        }
+
         template<typename T, typename SPLINE_G0_TYPE>
         T eval_Gij(const InvAMatrix<T>& invA, const SPLINE_G0_TYPE& spline_G0, int row_A, int col_A);
 
@@ -53,30 +125,53 @@ namespace alps {
 
             alps::numeric::matrix<T> &matrix() { return matrix_;}
             alps::numeric::matrix<T> const &matrix() const { return matrix_;}
-            std::vector<creator> &creators(){ return creators_;}
-            const std::vector<creator> &creators() const{ return creators_;}
-            std::vector<annihilator> &annihilators(){ return annihilators_;}
-            const std::vector<annihilator> &annihilators()const{ return annihilators_;}
+
+            //number of rows (columns), i.e., pairs of a creation and an annihilation operator
+            int num_ops() const {return times_.size();}
+
+            //operators are stored as structure of arrays. A creator and an annihilator at the same index share time and small index.
+            const std::vector<itime_t> &times() const {return times_;}
+            const std::vector<int> &small_indices() const {return small_indices_;}
+            const std::vector<site_t> &creator_sites() const {return creator_sites_;}
+            const std::vector<site_t> &annihilator_sites() const {return annihilator_sites_;}
+            creator creator_at(int pos) const {
+              assert(pos>=0 && pos<num_ops());
+              return creator(flavor_, creator_sites_[pos], operator_time(times_[pos], small_indices_[pos]));
+            }
+            annihilator annihilator_at(int pos) const {
+              assert(pos>=0 && pos<num_ops());
+              return annihilator(flavor_, annihilator_sites_[pos], operator_time(times_[pos], small_indices_[pos]));
+            }
+
             T alpha_at(int pos) const {
-              assert(pos>=0 && pos<creators_.size());
-              return creators_[pos].s()==annihilators_[pos].s() ? alpha_[pos] : alpha_[pos];
+              assert(pos>=0 && pos<num_ops());
+              return alpha_[pos];
             }
             T bare_alpha_at(int pos) const {
-              assert(pos>=0 && pos<creators_.size());
+              assert(pos>=0 && pos<num_ops());
               return alpha_[pos];
             }
             void set_alpha(int pos, T new_val) {
-              assert(pos>=0 && pos<creators_.size());
+              assert(pos>=0 && pos<num_ops());
               alpha_[pos] = new_val;
             }
-            void alpha_push_back(T new_elem) {alpha_.push_back(new_elem);}
-            std::vector<std::pair<vertex_t,size_t> > &vertex_info(){ return vertex_info_;}
-            const std::vector<std::pair<vertex_t,size_t> > &vertex_info() const{ return vertex_info_;}
+
+            vertex_t vertex_type(int pos) const {
+              assert(pos>=0 && pos<num_ops());
+              return vertex_types_[pos];
+            }
+            size_t vertex_rank(int pos) const {
+              assert(pos>=0 && pos<num_ops());
+              return vertex_ranks_[pos];
+            }
+            my_uint64 vertex_uid(int pos) const {
+              assert(pos>=0 && pos<num_ops());
+              return vertex_uids_[pos];
+            }
 
             int find_row_col(my_uint64 v_uid, int i_rank) const {
-              for(std::size_t i=0; i<creators_.size(); ++i) {
-                //if (time==creators_[i].t().time() && vertex_info_[i].first==type && vertex_info_[i].second==i_rank) {
-                if (vertex_uid(i)==v_uid && boost::get<1>(vertex_info_[i])==i_rank) {
+              for(int i=0; i<num_ops(); ++i) {
+                if (vertex_uids_[i]==v_uid && vertex_ranks_[i]==i_rank) {
                   return i;
                 }
               }
@@ -85,8 +180,8 @@ namespace alps {
 
             std::vector<int> find_row_col(my_uint64 v_uid) const {
               std::vector<int> pos;
-              for(std::size_t i=0; i<creators_.size(); ++i) {
-                if (vertex_uid(i)==v_uid) {
+              for(int i=0; i<num_ops(); ++i) {
+                if (vertex_uids_[i]==v_uid) {
                   pos.push_back(i);
                 }
               }
@@ -96,19 +191,19 @@ namespace alps {
               return pos;
             }
 
-            my_uint64 vertex_uid(int pos) const {
-              assert(pos>=0 && pos<vertex_info_.size());
-              return boost::get<2>(vertex_info_[pos]);
-            }
             template<typename SPLINE_G0_TYPE>
             bool sanity_check(const SPLINE_G0_TYPE& spline_G0) const;
             void swap_ops(size_t i1, size_t i2) {
-              assert(i1>=0 && i1<creators_.size());
-              assert(i2>=0 && i2<creators_.size());
-              std::swap(creators_[i1], creators_[i2]);
-              std::swap(annihilators_[i1], annihilators_[i2]);
+              assert(i1>=0 && i1<num_ops());
+              assert(i2>=0 && i2<num_ops());
+              std::swap(times_[i1], times_[i2]);
+              std::swap(small_indices_[i1], small_indices_[i2]);
+              std::swap(creator_sites_[i1], creator_sites_[i2]);
+              std::swap(annihilator_sites_[i1], annihilator_sites_[i2]);
               std::swap(alpha_[i1], alpha_[i2]);
-              std::swap(vertex_info_[i1], vertex_info_[i2]);
+              std::swap(vertex_types_[i1], vertex_types_[i2]);
+              std::swap(vertex_ranks_[i1], vertex_ranks_[i2]);
+              std::swap(vertex_uids_[i1], vertex_uids_[i2]);
             }
             void swap_rows_cols(size_t i1, size_t i2) {
               swap_ops(i1, i2);
@@ -125,10 +220,7 @@ namespace alps {
             void update_matrix(const InvGammaMatrix<T>& inv_gamma, const SPLINE_G0_TYPE& spline_G0);
             void remove_rows_cols(const std::vector<int>& rows_cols);
             void pop_back_op() {
-              creators_.pop_back();
-              annihilators_.pop_back();
-              alpha_.pop_back();
-              vertex_info_.pop_back();
+              resize_ops(num_ops()-1);
             }
             void push_back_op(const creator& cdag_op, const annihilator& c_op, T alpha, const vertex_info_type& vertex_info);
             template<typename SPLINE_G0_TYPE>
@@ -150,16 +242,43 @@ namespace alps {
             template<typename SPLINE_G0_TYPE, typename M>
             void eval_Gij_col_part(const SPLINE_G0_TYPE& spline_G0, const std::vector<int>& rows, int col, M& Gij) const;
 
+            //G0 between the annihilators at rows first, ..., first+num-1 and the creator at col
+            template<typename SPLINE_G0_TYPE>
+            void eval_G0_col(const SPLINE_G0_TYPE& spline_G0, int first, int num, int col, T* values) const {
+              assert(first>=0 && first+num<=num_ops());
+              eval_G0_annihilators(spline_G0, creator_at(col), times_.data()+first, small_indices_.data()+first,
+                                   annihilator_sites_.data()+first, num, values);
+            }
+
         private:
             //compute G0 (and reuse cached data)
             template<typename SPLINE_G0_TYPE>
             alps::numeric::submatrix_view<T> compute_G0_col(const SPLINE_G0_TYPE& spline_G0, int col) const;
 
+
+            void resize_ops(int n) {
+              times_.resize(n);
+              small_indices_.resize(n);
+              creator_sites_.resize(n);
+              annihilator_sites_.resize(n);
+              alpha_.resize(n);
+              vertex_types_.resize(n);
+              vertex_ranks_.resize(n);
+              vertex_uids_.resize(n);
+            }
+
             alps::numeric::matrix<T> matrix_;
-            std::vector<creator> creators_;         //an array of creation operators c_dagger corresponding to the row of the matrix
-            std::vector<annihilator> annihilators_; //an array of to annihilation operators c corresponding to the column of the matrix
-            std::vector<T> alpha_;             //an array of doubles corresponding to the alphas of Rubtsov for the c, cdaggers at the same index.
-            std::vector<vertex_info_type> vertex_info_; // an array of pairs which remember from which type of vertex operators come from. (type of vertex and rank)
+
+            //operators corresponding to the rows and columns of the matrix (structure of arrays)
+            spin_t flavor_;                         //all the operators have the same flavor
+            std::vector<itime_t> times_;            //imaginary times of c^dagger and c
+            std::vector<int> small_indices_;        //small indices used for ordering operators at equal time
+            std::vector<site_t> creator_sites_;     //sites of c^dagger (rows)
+            std::vector<site_t> annihilator_sites_; //sites of c (columns)
+            std::vector<T> alpha_;                  //alphas of Rubtsov for the c, cdaggers at the same index.
+            std::vector<vertex_t> vertex_types_;    //type of the vertex that operators come from
+            std::vector<size_t> vertex_ranks_;      //rank in the vertex
+            std::vector<my_uint64> vertex_uids_;    //unique id of the vertex
 
             //work space for update()
             alps::numeric::matrix<T> G0_left, invA0, G0_inv_gamma;
@@ -316,7 +435,7 @@ namespace alps {
         class SubmatrixUpdate
         {
         public:
-            typedef boost::function<T(const annihilator&,const creator&)> SPLINE_G0_TYPE;
+            typedef G0Interpolator<T> SPLINE_G0_TYPE;
 
             SubmatrixUpdate(int k_ins_max, int n_flavors, SPLINE_G0_TYPE spline_G0, general_U_matrix<T>* p_Uijkl, double beta);//, const alps::params &p);
 
@@ -42,7 +42,7 @@ SubmatrixUpdate<T>::SubmatrixUpdate(int k_ins_max, int n_flavors, SPLINE_G0_TYPE
 
     itime_vertices_ = itime_vertices_init;
     for (int iv=0; iv<itime_vertices_.size(); ++iv) {
-      itime_vertices_[iv].set_unique_id(gen_new_vertex_id());
+      itime_vertices_.set_unique_id(iv, gen_new_vertex_id());
     }
     boost::tie(sign_det_A_,sign_) = invA_.init(p_Uijkl, spline_G0, itime_vertices_, 0);
   }
@@ -61,12 +61,9 @@ T eval_Gij(const InvAMatrix<T>& invA, const SPLINE_G0_TYPE& spline_G0, int row_A
   } else {
     //use Eq. (A4)
     const int Nv = invA.matrix().size1();
-    assert (invA.creators().size()==Nv);
-    assert (invA.annihilators().size()==Nv);
+    assert (invA.num_ops()==Nv);
     G0.destructive_resize(Nv, 1);
-    for (int iv=0; iv<Nv; ++iv) {
-      G0(iv,0) = spline_G0(invA.annihilators()[iv], invA.creators()[col_A]);
-    }
+    invA.eval_G0_col(spline_G0, 0, Nv, col_A, &G0(0,0));
     //alps::numeric::submatrix_view<T> invA_view(invA.matrix(), row_A, 0, 1, Nv);
     //mygemm((T) 1.0, invA_view, G0, (T) 0.0, invA_G0);
     invA_G0.block() = invA.matrix().block(row_A, 0, 1, Nv) * G0.block();
@@ -140,8 +137,8 @@ void SubmatrixUpdate<T>::init_update(const std::vector<itime_vertex>& non_int_it
   //set starting point
   for (int iv=0; iv<non_int_itime_vertices.size(); ++iv) {
     itime_vertices_.push_back(non_int_itime_vertices[iv]);
-    itime_vertices_[iv+begin_index].set_non_interacting();
-    itime_vertices_[iv+begin_index].set_unique_id(gen_new_vertex_id());
+    itime_vertices_.set_non_interacting(iv+begin_index);
+    itime_vertices_.set_unique_id(iv+begin_index, gen_new_vertex_id());
   }
   itime_vertices0_ = itime_vertices_;// tilde C^0 in Eq. (20)
 
@@ -170,16 +167,8 @@ void SubmatrixUpdate<T>::finalize_update() {
 
   //remove cols and rows corresponding to non-interacting vertices
   std::vector<my_uint64> uid_removed;
-  itime_vertex_container new_itime_vertices;
-  for (int iv=0; iv<itime_vertices_.size(); ++iv) {
-    if (itime_vertices_[iv].is_non_interacting()) {
-      uid_removed.push_back(itime_vertices_[iv].unique_id());
-    } else {
-      new_itime_vertices.push_back(itime_vertices_[iv]);
-    }
-  }
+  itime_vertices_.remove_non_interacting(uid_removed);
   invA_.remove_rows_cols(uid_removed);
-  std::swap(itime_vertices_, new_itime_vertices);
 
   for (int flavor=0; flavor<n_flavors(); ++flavor) {
     gamma_matrices_[flavor].clear();
@@ -187,10 +176,7 @@ void SubmatrixUpdate<T>::finalize_update() {
 
   //some check
   for (int flavor=0; flavor<n_flavors(); ++flavor) {
-    const int Nv = invA_[flavor].annihilators().size();
-    if (invA_[flavor].creators().size()!=Nv) {
-      throw std::logic_error("creators().size() != annihilators().size()");
-    }
+    const int Nv = invA_[flavor].num_ops();
     for (int iv=0; iv<Nv; ++iv) {
       if (invA_[flavor].alpha_at(iv)==ALPHA_NON_INT) {
         throw std::logic_error("Found an operator corresponding to a non-interacting vertex.");
@@ -245,7 +231,7 @@ SubmatrixUpdate<T>::try_spin_flip(const std::vector<int>& pos, const std::vector
       U_rat /= -vdef.Uval();
     }
 
-    for (int rank=0; rank<vdef.rank(); ++rank) {
+    for (int rank=0; rank<VERTEX_RANK; ++rank) {
       const int flavor_rank = vdef.flavors()[rank];
       const operator_time op_t = operator_time(v.time(),-rank);
       const T alpha0 = itime_vertices0_[iv].is_non_interacting()
@@ -335,10 +321,10 @@ void SubmatrixUpdate<T>::perform_spin_flip(const std::vector<int>& pos, const st
 
   for (int i_pos=0; i_pos<pos.size(); ++i_pos) {
     if (new_spins[i_pos]==NON_INT_SPIN_STATE) {
-      itime_vertices_[pos[i_pos]].set_non_interacting();
+      itime_vertices_.set_non_interacting(pos[i_pos]);
     } else {
-      itime_vertices_[pos[i_pos]].set_interacting();
-      itime_vertices_[pos[i_pos]].set_af_state(new_spins[i_pos]);
+      itime_vertices_.set_interacting(pos[i_pos]);
+      itime_vertices_.set_af_state(pos[i_pos], new_spins[i_pos]);
     }
   }
 
@@ -394,9 +380,7 @@ std::pair<T,T> SubmatrixUpdate<T>::compute_M_from_scratch(std::vector<alps::nume
     M[flavor].conservative_resize(Nv, Nv);
     if (Nv>0) {
       for (int j=0; j<Nv; ++j) {
-        for (int i=0; i<Nv; ++i) {
-          M[flavor](i,j) = spline_G0_(invA_[flavor].annihilators()[i], invA_[flavor].creators()[j]);
-        }
+        invA_[flavor].eval_G0_col(spline_G0_, 0, Nv, j, &M[flavor](0,j));
         M[flavor](j,j) -= invA_[flavor].alpha_at(j);
       }
       const T det = M[flavor].determinant();
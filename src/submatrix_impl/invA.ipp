@@ -6,36 +6,37 @@
 template<typename T>
 InvAMatrix<T>::InvAMatrix() :
     matrix_(0,0),
-    creators_(0),
-    annihilators_(0),
-    alpha_(0),
-    vertex_info_(0),
+    flavor_(0),
     G0_cache(0,0),
     index_G0_cache(0),
     num_entry_G0_cache(0)
 {
-  assert(annihilators_.size()==0);
-  assert(creators_.size()==0);
+  assert(num_ops()==0);
 }
 
 template<typename T>
 void
 InvAMatrix<T>::push_back_op(const creator& cdag_op, const annihilator& c_op, T alpha, const vertex_info_type& vertex_info) {
-  assert(annihilators_.size()==creators_.size());
-  assert(annihilators_.size()==alpha_.size());
-  assert(annihilators_.size()==vertex_info_.size());
-
-  creators_.push_back(cdag_op);
-  annihilators_.push_back(c_op);
+  assert(cdag_op.flavor()==c_op.flavor());
+  assert(cdag_op.t()==c_op.t());
+  assert(num_ops()==0 || cdag_op.flavor()==flavor_);
+
+  flavor_ = cdag_op.flavor();
+  times_.push_back(cdag_op.t().time());
+  small_indices_.push_back(cdag_op.t().small_index());
+  creator_sites_.push_back(cdag_op.s());
+  annihilator_sites_.push_back(c_op.s());
   alpha_.push_back(alpha);
-  vertex_info_.push_back(vertex_info);
+  vertex_types_.push_back(boost::get<0>(vertex_info));
+  vertex_ranks_.push_back(boost::get<1>(vertex_info));
+  vertex_uids_.push_back(boost::get<2>(vertex_info));
 }
 
 template<typename T>
 template<typename SPLINE_G0_TYPE>
 void InvAMatrix<T>::extend(const SPLINE_G0_TYPE& spline_G0) {
   const int noperators = matrix_.size2();//num of operators corresponding to interacting vertices
-  const int nops_add = creators_.size()-noperators;//num of operators corresponding to non-interacting vertices
+  const int nops_add = num_ops()-noperators;//num of operators corresponding to non-interacting vertices
   if (nops_add==0) {
     return;
   }
@@ -66,8 +67,10 @@ void InvAMatrix<T>::extend(const SPLINE_G0_TYPE& spline_G0) {
   static alps::numeric::matrix<T> B;
   B.destructive_resize(nops_add, noperators);
   for (int j = 0; j < noperators; ++j) {
+    const T coeff = -(eval_f(alpha_[j]) - 1.0);
+    eval_G0_col(spline_G0, noperators, nops_add, j, &B(0, j));
     for (int i = 0; i < nops_add; ++i) {
-      B(i, j) = -spline_G0(annihilators_[i + noperators], creators_[j]) * (eval_f(alpha_[j]) - 1.0);
+      B(i, j) *= coeff;
     }
   }
 
@@ -86,17 +89,16 @@ template<typename SPLINE_G0_TYPE>
 bool InvAMatrix<T>::sanity_check(const SPLINE_G0_TYPE& spline_G0) const {
   bool result = true;
 #ifndef NDEBUG
+  const int n = num_ops();
   assert(matrix_.size1()==matrix_.size2());
-  assert(matrix_.size1()==creators_.size());
-  assert(creators_.size()==annihilators_.size());
-  assert(creators_.size()==alpha_.size());
-  assert(creators_.size()==vertex_info_.size());
+  assert(matrix_.size1()==n);
+  assert(small_indices_.size()==n && creator_sites_.size()==n && annihilator_sites_.size()==n);
+  assert(alpha_.size()==n && vertex_types_.size()==n && vertex_ranks_.size()==n && vertex_uids_.size()==n);
 
   result = result && (matrix_.size1()==matrix_.size2());
-  result = result && (matrix_.size1()==creators_.size());
-  result = result && (creators_.size()==annihilators_.size());
-  result = result && (creators_.size()==alpha_.size());
-  result = result && (creators_.size()==vertex_info_.size());
+  result = result && (matrix_.size1()==n);
+  result = result && (small_indices_.size()==n && creator_sites_.size()==n && annihilator_sites_.size()==n);
+  result = result && (alpha_.size()==n && vertex_types_.size()==n && vertex_ranks_.size()==n && vertex_uids_.size()==n);
 #endif
   return result;
 }
@@ -107,7 +109,7 @@ bool InvAMatrix<T>::sanity_check(const SPLINE_G0_TYPE& spline_G0) const {
 template<typename T>
 template<typename SPLINE_G0_TYPE>
 std::pair<T,T> InvAMatrix<T>::recompute_matrix(const SPLINE_G0_TYPE& spline_G0, bool check_error) {
-  const int Nv = annihilators_.size();
+  const int Nv = num_ops();
 
   if (Nv==0) return std::make_pair((T)1.0, (T)1.0);
 
@@ -130,8 +132,9 @@ std::pair<T,T> InvAMatrix<T>::recompute_matrix(const SPLINE_G0_TYPE& spline_G0,
   }
   matrix_.conservative_resize(Nv, Nv);
   for (int j=0; j<Nv; ++j) {
+    eval_G0_col(spline_G0, 0, Nv, j, &matrix_(0,j));
     for (int i=0; i<Nv; ++i) {
-      matrix_(i,j) = -spline_G0(annihilators_[i], creators_[j])*(F[j]-1.0);
+      matrix_(i,j) *= -(F[j]-1.0);
     }
     matrix_(j,j) += F[j];
   }
@@ -158,7 +161,7 @@ std::pair<T,T> InvAMatrix<T>::recompute_matrix(const SPLINE_G0_TYPE& spline_G0,
  */
 template<typename T>
 T InvAMatrix<T>::compute_f_prod() const {
-  const int Nv = annihilators_.size();
+  const int Nv = num_ops();
 
   if (Nv==0) return (T)1.0;
 
@@ -182,7 +185,7 @@ InvAMatrixFlavors<T>::add_non_interacting_vertices(general_U_matrix<T>* p_Uijkl,
     const itime_vertex& v = itime_vertices[iv];
     const vertex_definition<T>& vdef = p_Uijkl->get_vertex(v.type());
     assert (v.is_non_interacting());
-    for (int rank=0; rank<vdef.rank(); ++rank) {
+    for (int rank=0; rank<VERTEX_RANK; ++rank) {
       const int flavor_rank = vdef.flavors()[rank];
       operator_time op_t(v.time(), -rank);
       sub_matrices_[flavor_rank].push_back_op(
@@ -215,7 +218,7 @@ InvAMatrixFlavors<T>::init(general_U_matrix<T>* p_Uijkl,
     const itime_vertex& v = itime_vertices[iv];
     const vertex_definition<T>& vdef = p_Uijkl->get_vertex(v.type());
     assert (!v.is_non_interacting());
-    for (int rank=0; rank<vdef.rank(); ++rank) {
+    for (int rank=0; rank<VERTEX_RANK; ++rank) {
       const int flavor_rank = vdef.flavors()[rank];
       operator_time op_t(v.time(), -rank);
       const T alpha = v.is_non_interacting() ? ALPHA_NON_INT : vdef.get_alpha(v.af_state(), rank);
@@ -243,10 +246,7 @@ void InvAMatrix<T>::remove_rows_cols(const std::vector<int>& rows_cols) {
   for (int i=0; i<rows_cols.size(); ++i) {
     swap_rows_cols(rows_cols[n_rows-1-i], Nv-1-i);
   }
-  creators_.resize(Nv-n_rows);
-  annihilators_.resize(Nv-n_rows);
-  alpha_.resize(Nv-n_rows);
-  vertex_info_.resize(Nv-n_rows);
+  resize_ops(Nv-n_rows);
   matrix_.conservative_resize(Nv-n_rows, Nv-n_rows);
 }
 
@@ -351,9 +351,7 @@ void InvAMatrix<T>::compute_M(alps::numeric::matrix<T>& M, const SPLINE_G0_TYPE&
 #ifndef NDEBUG
   alps::numeric::matrix<T> G0(N,N), G0_M(N,N);
   for (int j=0; j<N; ++j) {
-    for (int i=0; i<N; ++i) {
-      G0(i,j) = spline_G0(annihilators()[i], creators()[j]);
-    }
+    eval_G0_col(spline_G0, 0, N, j, &G0(0,j));
     G0(j,j) -= alpha_at(j);
   }
   //mygemm((T) 1.0, G0, M, (T) 0.0, G0_M);
@@ -449,9 +447,7 @@ alps::numeric::submatrix_view<T> InvAMatrix<T>::compute_G0_col(const SPLINE_G0_T
     if (G0_cache.size2()<=num_entry_G0_cache) {
       G0_cache.conservative_resize(Nv, static_cast<int>(1.5*num_entry_G0_cache)+1);
     }
-    for (int iv=0; iv<Nv; ++iv) {
-      G0_cache(iv,index) = spline_G0(annihilators_[iv], creators_[col]);
-    }
+    eval_G0_col(spline_G0, 0, Nv, col, &G0_cache(0,index));
     ++num_entry_G0_cache;
     return G0_cache.block(0, index, Nv, 1);
   }
@@ -494,7 +490,7 @@ InvAMatrixFlavors<T>::sanity_check(const SPLINE_G0_TYPE& spline_G0, general_U_ma
   for (int iv=0; iv<itime_vertices.size(); ++iv) {
     const itime_vertex& v = itime_vertices[iv];
     const vertex_definition<T>& vdef = p_Uijkl->get_vertex(v.type());
-    for (int rank=0; rank<v.rank(); ++rank) {
+    for (int rank=0; rank<VERTEX_RANK; ++rank) {
       const int flavor_rank = vdef.flavors()[rank];
       operator_time op_t(v.time(), -rank);
       creators_scr[flavor_rank].push_back(
@@ -511,15 +507,15 @@ InvAMatrixFlavors<T>::sanity_check(const SPLINE_G0_TYPE& spline_G0, general_U_ma
 
   for (int flavor=0; flavor<n_flavors; ++flavor) {
     result = result && sub_matrices_[flavor].sanity_check(spline_G0);
-    assert(sub_matrices_[flavor].annihilators().size()==annihilators_scr[flavor].size());
-    assert(sub_matrices_[flavor].creators().size()==creators_scr[flavor].size());
+    assert(sub_matrices_[flavor].num_ops()==annihilators_scr[flavor].size());
+    assert(sub_matrices_[flavor].num_ops()==creators_scr[flavor].size());
 
     //check operators one by one
     for (int iop=0; iop<creators_scr[flavor].size(); ++iop) {
       //const int pos = sub_matrices_[flavor].find_row_col(creators_scr[flavor][iop].t());
       const int pos = sub_matrices_[flavor].find_row_col(v_uid_scr[flavor][iop], rank_scr[flavor][iop]);
-      assert(sub_matrices_[flavor].creators()[pos]==creators_scr[flavor][iop]);
-      assert(sub_matrices_[flavor].annihilators()[pos]==annihilators_scr[flavor][iop]);
+      assert(sub_matrices_[flavor].creator_at(pos)==creators_scr[flavor][iop]);
+      assert(sub_matrices_[flavor].annihilator_at(pos)==annihilators_scr[flavor][iop]);
       assert(sub_matrices_[flavor].alpha_at(pos)==alpha_scr[flavor][iop]);
     }
   }
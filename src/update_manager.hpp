@@ -5,6 +5,7 @@
 #pragma once
 
 #include <vector>
+#include <map>
 
 #include <alps/params.hpp>
 
@@ -12,6 +13,8 @@
 #include <boost/random/uniform_01.hpp>
 #include <boost/random/discrete_distribution.hpp>
 
+#include <Eigen/LU>
+
 #include "accumulators.hpp"
 #include "submatrix.hpp"
 #include "green_function.h"
@@ -22,10 +25,6 @@
 namespace alps {
     namespace ctint {
 
-        template<typename T, typename SPLINE_G0>
-        T
-        compute_weight(const general_U_matrix<T>& Uijkl, const SPLINE_G0& spline_G0, const itime_vertex_container& itime_vertices);
-
         class SymmExpDist {
         public:
             SymmExpDist() : a_(0), b_(0), beta_(0), coeff_(0), coeffX_(0) {}
@@ -36,11 +35,40 @@ namespace alps {
             double operator()(double dtau) const {return coeff_*bare_value(dtau);}
             double bare_value(double dtau) const {return std::exp(-a_*dtau)+std::exp(-a_*(beta_-dtau))+ b_;}
             double coeff_X(double dtau) const {return coeffX_;}
+            double a() const {return a_;}
+            double b() const {return b_;}
 
         private:
             double a_, b_, beta_, coeff_, coeffX_;
         };
 
+        /**
+         * Corrections to the acceptance rates of double-vertex updates from the proposal probabilities.
+         * The first vertex of an inserted pair is placed uniformly in [0, beta) and the second one at a distance drawn from p
+         * (generate_valid_vertex_pair2). A pair is removed as in pick_up_valid_vertex_pair2.
+         */
+        //P_rem/P_ins for the insertion of the non-interacting vertices at pos1 and pos2
+        inline double double_vertex_insertion_corr(const itime_vertex_container& itime_vertices, int pos1, int pos2,
+                                                   double beta, const SymmExpDist& p) {
+          const itime_vertex& v1 = itime_vertices[pos1];
+          const itime_vertex& v2 = itime_vertices[pos2];
+          assert(v1.is_non_interacting() && v2.is_non_interacting());
+          const double dtau = mymod(v2.time()-v1.time(), beta);
+
+          //probability of picking up the pair in the removal after the insertion (see vertex_pair_removal_prob)
+          //divided by p(dtau), which cancels against the proposal probability of the insertion
+          const double n_v1 = itime_vertices.num_interacting(v1.type())+1.0;
+          const double F = sum_pair_weights(itime_vertices, v2.type(), v1.time(), beta, p) + p.bare_value(dtau);
+          return (beta*beta)*p.coeff_X(dtau)/(n_v1*F);
+        }
+
+        //P_ins/P_rem for the removal of the interacting vertices at pos1 and pos2 picked up with probability prob
+        inline double double_vertex_removal_corr(const itime_vertex_container& itime_vertices, int pos1, int pos2, double prob,
+                                                 double beta, const SymmExpDist& p) {
+          const double dtau = mymod(itime_vertices[pos2].time()-itime_vertices[pos1].time(), beta);
+          return p.bare_value(dtau)/((beta*beta)*p.coeff_X(dtau)*prob);
+        }
+
         template<typename T>
         class VertexUpdateManager {
         public:
@@ -57,9 +85,20 @@ namespace alps {
             template<typename M>
             void measure_observables(M&);
 
+            //Called once per Monte Carlo step during thermalization: refit the pair-distance distribution of double-vertex updates
+            void adapt_proposals();
+
             //fix parameters
             void prepare_for_measurement_steps();
 
+            //Acceptance rate of insertions and removals since the last call to reset_ins_rem_acceptance (used in the pilot phase for alpha)
+            std::pair<double,double> ins_rem_acceptance() const {
+              return std::make_pair(num_ins_rem_accepted, num_ins_rem_attempted);
+            }
+            void reset_ins_rem_acceptance() {
+              num_ins_rem_accepted = num_ins_rem_attempted = 0.0;
+            }
+
             template<typename R>
             T do_ins_rem_update(SubmatrixUpdate<T>& submatrix, const general_U_matrix<T>& Uijkl, R& random, double U_scale);
 
@@ -70,7 +109,7 @@ namespace alps {
             T do_shift_update(SubmatrixUpdate<T>& submatrix, const general_U_matrix<T>& Uijkl, R& random, bool tune_step_size);
 
             template< typename SPLINE_G0, typename R>
-            void global_updates(boost::shared_ptr<SubmatrixUpdate<T> > submatrix, general_U_matrix<T>& Uijkl, const SPLINE_G0& spline_G0, R& random01);
+            void global_updates(boost::shared_ptr<SubmatrixUpdate<T> >& submatrix, general_U_matrix<T>& Uijkl, const SPLINE_G0& spline_G0, R& random01);
 
         private:
 
@@ -91,6 +130,17 @@ namespace alps {
             template<typename R>
             double pick_up_vertices_to_be_removed(const itime_vertex_container& itime_vertices_current, R& random01, std::vector<int>& pos_vertices) const;
 
+            //Number of interacting vertices whose types are updated by single-vertex updates: O(number of types)
+            int num_sv_update_candidates(const itime_vertex_container& itime_vertices) const {
+              int num_cand = 0;
+              for (int type=0; type<sv_update_vertices_flag.size(); ++type) {
+                if (sv_update_vertices_flag[type]) {
+                  num_cand += itime_vertices.num_interacting(type);
+                }
+              }
+              return num_cand;
+            }
+
             template<typename R>
             T spin_flip_step(SubmatrixUpdate<T>& submatrix, const general_U_matrix<T>& Uijkl, R& random, int pos_vertex);
 
@@ -107,6 +157,13 @@ namespace alps {
             //for single vertex update
             std::vector<int> sv_update_vertices;
             std::vector<bool> sv_update_vertices_flag;
+            const bool importance_sampling_U;
+            WalkerAliasTable sv_update_alias_table;//over vertex types, weights |U| (only with importance_sampling_U)
+
+            //probability of proposing a vertex type in single-vertex insertions
+            double sv_proposal_prob(int type) const {
+              return importance_sampling_U ? sv_update_alias_table.probability(type) : 1.0/sv_update_vertices.size();
+            }
 
             //for double vertex update
             std::vector<std::pair<int,int> > mv_update_valid_pair;
@@ -132,9 +189,16 @@ namespace alps {
             int num_shift_valid_vertex_types;
             double shift_step_size;
 
+            //adaptation of proposal distributions during thermalization (frozen in measurement steps)
+            bool tune_proposals;
+            const double shift_target_acceptance;
+            long num_shift_tuning_steps;
+            const bool verbose;
+
             //only acceptance rate
             //simple_update_statistcs simple_statistics_rem, simple_statistics_ins;
             //int num_accepted_shift;
+            double num_ins_rem_attempted, num_ins_rem_accepted;
 
             //Statistics about multi-vertex updates (imaginary time information)
             //scalar_histogram_flavors statistics_rem, statistics_ins, statistics_shift, statistics_dv_rem, statistics_dv_ins;
@@ -152,36 +216,31 @@ namespace alps {
             k_ins_max(parms["update.k_ins_max"]),
             max_order(parms["update.max_order"]),
             num_vertex_type(Uijkl.get_vertices().size()),
-            n_multi_vertex_update(1),
-            //n_multi_vertex_update(parms["update.n_multi_vertex_update"]),
+            n_multi_vertex_update(parms["update.n_multi_vertex_update"]),
             n_shift(parms["update.n_vertex_shift"]),
             sv_update_vertices(),
             sv_update_vertices_flag(num_vertex_type, false),
+            importance_sampling_U(parms["update.importance_sampling_U"]),
             shift_update_valid(num_vertex_type, false),
             num_shift_valid_vertex_types(0),
             shift_step_size(beta*parms["update.vertex_shift_step_size"].template as<double>()),
+            tune_proposals(parms["update.tune_proposals"]),
+            shift_target_acceptance(parms["update.vertex_shift_target_acceptance"]),
+            num_shift_tuning_steps(0),
+            verbose(message),
+            num_ins_rem_attempted(0.0),
+            num_ins_rem_accepted(0.0),
             statistics_ins((parms["update.n_tau_statistics"]), beta, n_multi_vertex_update-1),
             statistics_shift((parms["update.n_tau_statistics"]), beta, num_vertex_type)
         {
           const double almost_zero = 1E-10;
 
-          if (n_multi_vertex_update==1) {
-            const std::vector<vertex_definition<T> >& v_defs_tmp = Uijkl.get_vertices();
-            sv_update_vertices.resize(v_defs_tmp.size());
-            for (int iv=0; iv<sv_update_vertices.size(); ++iv) {
-              sv_update_vertices[iv] = iv;
-            }
-            std::fill(sv_update_vertices_flag.begin(), sv_update_vertices_flag.end(), true);
-          } else {
-            const std::vector<vertex_definition<T> >& v_defs_tmp = Uijkl.get_vertices();
-            assert(v_defs_tmp.size()==num_vertex_type);
-            sv_update_vertices.resize(0);
-            for (int iv=0; iv<num_vertex_type; ++iv) {
-              if (v_defs_tmp[iv].is_density_type()) {
-                sv_update_vertices.push_back(iv);
-                sv_update_vertices_flag[iv] = true;
-              }
-            }
+          if (n_multi_vertex_update!=1 && n_multi_vertex_update!=2) {
+            throw std::runtime_error("update.n_multi_vertex_update must be 1 or 2");
+          }
+          if (n_multi_vertex_update>1 && (parms["update.double_vertex_update_A"].template as<double>()<=0.0 ||
+                                          parms["update.double_vertex_update_B"].template as<double>()<0.0)) {
+            throw std::runtime_error("update.double_vertex_update_A must be positive and update.double_vertex_update_B non-negative");
           }
 
           if (n_multi_vertex_update>1) {
@@ -217,6 +276,38 @@ namespace alps {
             symm_exp_dist = SymmExpDist(parms["update.double_vertex_update_A"], parms["update.double_vertex_update_B"], beta);
           }
 
+          if (n_multi_vertex_update==1) {
+            const std::vector<vertex_definition<T> >& v_defs_tmp = Uijkl.get_vertices();
+            sv_update_vertices.resize(v_defs_tmp.size());
+            for (int iv=0; iv<sv_update_vertices.size(); ++iv) {
+              sv_update_vertices[iv] = iv;
+            }
+            std::fill(sv_update_vertices_flag.begin(), sv_update_vertices_flag.end(), true);
+          } else {
+            const std::vector<vertex_definition<T> >& v_defs_tmp = Uijkl.get_vertices();
+            assert(v_defs_tmp.size()==num_vertex_type);
+            sv_update_vertices.resize(0);
+            for (int iv=0; iv<num_vertex_type; ++iv) {
+              //Non-density vertices carrying no quantum number cannot be paired, so they are updated individually
+              bool zero_qn = true;
+              for (int i_af=0; i_af<quantum_number_vertices[iv].size(); ++i_af) {
+                zero_qn = zero_qn && is_all_zero<int>(quantum_number_vertices[iv][i_af]);
+              }
+              if (v_defs_tmp[iv].is_density_type() || zero_qn) {
+                sv_update_vertices.push_back(iv);
+                sv_update_vertices_flag[iv] = true;
+              }
+            }
+          }
+
+          if (importance_sampling_U && sv_update_vertices.size()>0) {
+            std::vector<double> weights(num_vertex_type, 0.0);
+            for (int iv=0; iv<sv_update_vertices.size(); ++iv) {
+              weights[sv_update_vertices[iv]] = std::abs(Uijkl.get_vertex(sv_update_vertices[iv]).Uval());
+            }
+            sv_update_alias_table = WalkerAliasTable(weights);
+          }
+
           if (n_shift>0) {
             std::fill(shift_update_valid.begin(), shift_update_valid.end(), true);
             for (int iv=0; iv<sv_update_vertices_flag.size(); ++iv) {
@@ -256,6 +347,10 @@ namespace alps {
                   std::cout << " " << iv << " " << src << " " << dst << " " << n_vtype << std::endl;
                   throw std::runtime_error("Invalid input in GLOBAL_UPDTES!");
                 }
+                if (Uijkl.get_vertex(iv).num_af_states()!=Uijkl.get_vertex(dst).num_af_states()) {
+                  std::cout << " vertex " << iv << " and vertex " << dst << " have different numbers of af states " << std::endl;
+                  throw std::runtime_error("Invalid input in GLOBAL_UPDTES!");
+                }
                 tmp_vec[iv] = dst;
               }
               global_update_set.insert(tmp_vec);
@@ -442,7 +537,9 @@ namespace alps {
 
           T prob = det_rat_A*f_rat*U_rat*acc_corr*std::pow(U_scale, 1.0*num_vertices_ins);
 
+          ++num_ins_rem_attempted;
           if (std::abs(prob)>random()) {
+            ++num_ins_rem_accepted;
             submatrix.perform_spin_flip(pos_vertices_work, new_spins_work);
             return det_rat_A*f_rat*U_rat;
           } else {
@@ -477,7 +574,9 @@ namespace alps {
 
           T prob = det_rat_A*f_rat*U_rat*acc_corr*std::pow(U_scale, -1.0*nv_rem);
 
+          ++num_ins_rem_attempted;
           if (std::abs(prob)>random()) {
+            ++num_ins_rem_accepted;
             submatrix.perform_spin_flip(pos_vertices_remove, new_spins_remove);
             return det_rat_A*f_rat*U_rat;
           } else {
@@ -515,10 +614,39 @@ namespace alps {
  */
         template<typename T>
         void VertexUpdateManager<T>::prepare_for_measurement_steps() {
+          if (tune_proposals && verbose) {
+            std::cout << "Proposal distributions tuned in thermalization steps:" << std::endl;
+            if (n_shift>0) {
+              std::cout << " shift step size = " << shift_step_size/beta << " beta" << std::endl;
+            }
+            if (n_multi_vertex_update>1) {
+              std::cout << " double-vertex update A = " << symm_exp_dist.a() << " B = " << symm_exp_dist.b() << std::endl;
+            }
+          }
+          //proposal distributions must be fixed to keep detailed balance
+          tune_proposals = false;
           statistics_ins.reset();
           statistics_shift.reset();
         }
 
+        template<typename T>
+        void VertexUpdateManager<T>::adapt_proposals() {
+          if (!tune_proposals || n_multi_vertex_update<2) {
+            return;
+          }
+          //The acceptance rate of double-vertex insertions as a function of the distance between the two vertices.
+          //The histogram is coarse-grained to about 20 bins so that a short thermalization provides enough samples.
+          std::vector<double> counter = statistics_ins.get_counter(), sumval = statistics_ins.get_sumval();
+          const int nrebin = std::max(1, static_cast<int>(counter.size())/20);
+          rebin(counter, nrebin);
+          rebin(sumval, nrebin);
+          double a = symm_exp_dist.a(), b = symm_exp_dist.b();
+          const double bin_width = nrebin*beta/statistics_ins.get_num_bins();
+          if (fit_symm_exp_profile(counter, sumval, bin_width, beta, a, b)) {
+            symm_exp_dist = SymmExpDist(a, b, beta);
+          }
+        }
+
         template<typename T>
         template<typename R>
         std::vector<itime_vertex>
@@ -533,10 +661,12 @@ namespace alps {
             }
             vertices.resize(1);
             const double time = random01()*beta;
-            const int iv_rnd = static_cast<int>(random01()*sv_update_vertices.size());
-            const vertex_definition<T>& vdef = Uijkl.get_vertex(sv_update_vertices[iv_rnd]);
+            const int type = importance_sampling_U ?
+                             sv_update_alias_table(random01) :
+                             sv_update_vertices[static_cast<int>(random01()*sv_update_vertices.size())];
+            const vertex_definition<T>& vdef = Uijkl.get_vertex(type);
             const int af_state = static_cast<size_t>(random01()*vdef.num_af_states());
-            vertices[0] = itime_vertex(vdef.id(), af_state, time, vdef.rank(), vdef.is_density_type());
+            vertices[0] = itime_vertex(vdef.id(), af_state, time, vdef.is_density_type());
           } else if (Nv==2) {
             if (mv_update_valid_pair.size()==0) {
               return std::vector<itime_vertex>();
@@ -556,34 +686,15 @@ namespace alps {
         VertexUpdateManager<T>::acc_rate_corr_insertion(const itime_vertex_container& itime_vertices_current, const std::vector<int>& pos_vertices, R& random01) const {
           const int Nv_updated = pos_vertices.size();
           if (Nv_updated==1) {
-            int num_cand = 0;
-            for (int iv=0; iv<itime_vertices_current.size(); ++iv) {
-              if (!itime_vertices_current[iv].is_non_interacting()
-                  && sv_update_vertices_flag[itime_vertices_current[iv].type()]) {
-                ++num_cand;
-              }
-            }
-            return (beta*sv_update_vertices.size())/(num_cand+1.0);
+            const int type = itime_vertices_current[pos_vertices[0]].type();
+            return beta/(sv_proposal_prob(type)*(num_sv_update_candidates(itime_vertices_current)+1.0));
           } else if (Nv_updated==2) {
-            itime_vertex_container itime_vertices_new(itime_vertices_current);
-            for (int iv=0; iv<Nv_updated; ++iv) {
-              itime_vertices_new[pos_vertices[iv]].set_interacting();
-            }
-
             const itime_vertex& v0 = itime_vertices_current[pos_vertices[0]];
             const itime_vertex& v1 = itime_vertices_current[pos_vertices[1]];
-
-            const double dtau = mymod(v0.time()-v1.time(), beta);
-            int n_vpair;
-            double F;
-
-            pick_up_valid_vertex_pair2(itime_vertices_new,
-                                       std::make_pair(v0.type(),v1.type()),
-                                       beta, symm_exp_dist, random01, n_vpair, F);
-            if (n_vpair==0) {
+            if (v0.type()==v1.type()) {
               throw std::logic_error("v_pair must be larger than 0.");
             }
-            return (beta*beta)*symm_exp_dist.coeff_X(dtau)/F;
+            return double_vertex_insertion_corr(itime_vertices_current, pos_vertices[0], pos_vertices[1], beta, symm_exp_dist);
           } else {
             throw std::runtime_error("Nv>2 not implemented");
           }
@@ -597,22 +708,23 @@ namespace alps {
           //choose vertices to be removed
           if (Nv_updated==1) {
             pos_vertices.resize(0);
-            pos_vertices.reserve(itime_vertices_current.size());
-            for (int iv=0; iv<itime_vertices_current.size(); ++iv) {
-              if (!itime_vertices_current[iv].is_non_interacting()
-                  && sv_update_vertices_flag[itime_vertices_current[iv].type()]) {
-                pos_vertices.push_back(iv);
+            const int num_cand = num_sv_update_candidates(itime_vertices_current);
+            if (num_cand>0) {
+              //the selected-th candidate counted type by type
+              int selected = static_cast<int>(num_cand*random01());
+              for (int type=0; type<sv_update_vertices_flag.size(); ++type) {
+                if (!sv_update_vertices_flag[type]) {
+                  continue;
+                }
+                const std::vector<int>& pos_type = itime_vertices_current.interacting_positions(type);
+                if (selected<pos_type.size()) {
+                  pos_vertices.push_back(pos_type[selected]);
+                  break;
+                }
+                selected -= pos_type.size();
               }
-            }
-            if (pos_vertices.size()>0) {
-              const int num_cand = pos_vertices.size();
-              std::swap(pos_vertices[0],
-                        pos_vertices[
-                          static_cast<int>(pos_vertices.size()*random01())
-                        ]
-              );
-              pos_vertices.resize(1);
-              return num_cand/(beta*sv_update_vertices.size());
+              assert(pos_vertices.size()==1);
+              return num_cand*sv_proposal_prob(itime_vertices_current[pos_vertices[0]].type())/beta;
             } else {
               return 0.0;
             }
@@ -621,21 +733,18 @@ namespace alps {
               pos_vertices.resize(0);
               return 0.0;
             }
-            int n_vpair;
-            double F;
+            double prob;
             std::pair<int,int> v_pair = mv_update_valid_pair[mv_update_valid_pair.size()*random01()];
-            std::pair<int,int> r = pick_up_valid_vertex_pair2(itime_vertices_current, v_pair, beta, symm_exp_dist, random01, n_vpair, F);
-            if (n_vpair>0) {
+            std::pair<int,int> r = pick_up_valid_vertex_pair2(itime_vertices_current, v_pair, beta, symm_exp_dist, random01, prob);
+            if (prob>0.0) {
               pos_vertices.resize(2);
               pos_vertices[0]=r.first;
               pos_vertices[1]=r.second;
-              const double t0 = itime_vertices_current[pos_vertices[0]].time();
-              const double t1 = itime_vertices_current[pos_vertices[1]].time();
               assert(itime_vertices_current[pos_vertices[0]].type()==v_pair.first);
               assert(itime_vertices_current[pos_vertices[1]].type()==v_pair.second);
               assert(!itime_vertices_current[pos_vertices[0]].is_non_interacting());
               assert(!itime_vertices_current[pos_vertices[1]].is_non_interacting());
-              return F/((beta*beta)*symm_exp_dist.coeff_X(mymod(t1-t0, beta)));
+              return double_vertex_removal_corr(itime_vertices_current, pos_vertices[0], pos_vertices[1], prob, beta, symm_exp_dist);
             } else {
               pos_vertices.resize(0);
               return 0.0;
@@ -730,8 +839,6 @@ namespace alps {
           submatrix.init_update(new_vertices_all);
 
           //perform actual updates
-          const double magic_number = 1.0;
-          //const double magic_number = std::pow(1.01, 1.0/num_shift);
           std::vector<int> pos_vertices_tmp(2), new_spins_tmp(2);
           for (int i_update=0; i_update<num_shift; ++i_update) {
             T det_rat_A, f_rat, U_rat;
@@ -751,19 +858,21 @@ namespace alps {
             assert(std::abs(U_rat-1.0)<1E-8);
             const T prob = det_rat_A*f_rat*U_rat;
 
-            if (std::abs(prob)>random()) {
+            const bool accepted = std::abs(prob)>random();
+            if (accepted) {
               submatrix.perform_spin_flip(pos_vertices_tmp, new_spins_tmp);
               statistics_shift.add_sample(pdist, 1.0, vertex_type);
-              if (tune_step_size) {
-                shift_step_size = std::min(shift_step_size*magic_number, beta);
-              }
               weight_rat *= prob;
             } else {
               submatrix.reject_spin_flip();
               statistics_shift.add_sample(pdist, 0.0, vertex_type);
-              if (tune_step_size) {
-                shift_step_size = std::min(shift_step_size/magic_number, beta);
-              }
+            }
+            if (tune_step_size && tune_proposals) {
+              //Robbins-Monro iteration driving the acceptance rate toward the target
+              ++num_shift_tuning_steps;
+              const double gain = 1.0/std::pow(static_cast<double>(num_shift_tuning_steps), 0.6);
+              shift_step_size *= std::exp(gain*((accepted ? 1.0 : 0.0)-shift_target_acceptance));
+              shift_step_size = std::max(std::min(shift_step_size, beta), 1E-3*beta);
             }
           } //i_update
 
@@ -773,65 +882,212 @@ namespace alps {
           return weight_rat;
         };
 
-        template<typename T, typename SPLINE_G0, typename UnaryOperator, typename R>
-        T global_update_impl(const general_U_matrix<T>& Uijkl, const SPLINE_G0& spline_G0, itime_vertex_container& itime_vertices,
-                             const UnaryOperator& op, R& random01, const T weight_old) {
-          itime_vertex_container itime_vertices_new;
-          for (int iv=0; iv<itime_vertices.size(); ++iv) {
-            itime_vertices_new.push_back(op(itime_vertices[iv]));
-          }
+        /**
+         * Determinant ratios of global updates, which change the types of vertices but not their times.
+         * The operators are labeled by p = VERTEX_RANK*iv+rank, and M = (G0-alpha)^{-1} of all of them is taken from the walker
+         * (M_pq = 0 for operators of different flavors, so that a relabeling may also change flavors).
+         * Relabeling k vertices changes the rows and columns of B = G0-alpha for the set S of their operators.
+         * With the set R of the other operators, B_RR is unchanged and
+         *   det(B')/det(B) = det(M_SS) det(X),  X = B'_SS - B'_SR B_RR^{-1} B'_RS,  B_RR^{-1} = M_RR - M_RS M_SS^{-1} M_SR,
+         * which costs O(k N^2). An accepted proposal updates M with the block inverse of B' at the same cost.
+         */
+        template<typename T, typename SPLINE_G0>
+        class GlobalUpdateEvaluator {
+        public:
+            typedef Eigen::Matrix<T,Eigen::Dynamic,Eigen::Dynamic> matrix_t;
+
+            GlobalUpdateEvaluator(const general_U_matrix<T>& Uijkl, const SPLINE_G0& spline_G0, SubmatrixUpdate<T>& walker)
+              : Uijkl_(Uijkl), spline_G0_(spline_G0), itime_vertices_(walker.itime_vertices()),
+                vertex_types_(itime_vertices_.size()) {
+              const int Nv = itime_vertices_.size();
+              std::map<my_uint64,int> pos_vertex;
+              for (int iv=0; iv<Nv; ++iv) {
+                vertex_types_[iv] = itime_vertices_[iv].type();
+                pos_vertex[itime_vertices_[iv].unique_id()] = iv;
+              }
 
-          const T weight_new = compute_weight(Uijkl, spline_G0, itime_vertices_new);
-          const T prob = weight_new/weight_old;
-          //std::cout << "prob " << weight_new << " " << weight_old << std::endl;
-          if (std::abs(prob)>random01()) {
-            std::swap(itime_vertices_new, itime_vertices);
-            //std::cout << "acc" << std::endl;
-            return weight_new;
-          } else {
-            //std::cout << "rejected" << std::endl;
-            return weight_old;
-          }
-        }
+              std::vector<alps::numeric::matrix<T> > M_flavors(walker.n_flavors());
+              walker.compute_M(M_flavors);
+              M_.setZero(VERTEX_RANK*Nv, VERTEX_RANK*Nv);
+              for (int flavor=0; flavor<walker.n_flavors(); ++flavor) {
+                const InvAMatrix<T>& invA = walker.invA()[flavor];
+                std::vector<int> ops(invA.num_ops());
+                for (int i=0; i<ops.size(); ++i) {
+                  ops[i] = VERTEX_RANK*pos_vertex[invA.vertex_uid(i)] + invA.vertex_rank(i);
+                }
+                for (int j=0; j<ops.size(); ++j) {
+                  for (int i=0; i<ops.size(); ++i) {
+                    M_(ops[i], ops[j]) = M_flavors[flavor](i, j);
+                  }
+                }
+              }
+            }
+
+            //vertex types of the current configuration
+            const std::vector<int>& vertex_types() const {return vertex_types_;}
+
+            //det(B')/det(B) for the new vertex types. The intermediate results are kept for accept().
+            T det_ratio(const std::vector<int>& vertex_types_new) {
+              assert(vertex_types_new.size()==vertex_types_.size());
+              vertex_types_new_ = vertex_types_new;
+              S_.clear();
+              R_.clear();
+              for (int iv=0; iv<vertex_types_.size(); ++iv) {
+                std::vector<int>& ops = vertex_types_new[iv]!=vertex_types_[iv] ? S_ : R_;
+                for (int rank=0; rank<VERTEX_RANK; ++rank) {
+                  ops.push_back(VERTEX_RANK*iv+rank);
+                }
+              }
+              const int k = S_.size(), n = R_.size();
+              if (k==0) {
+                return 1.0;
+              }
+
+              matrix_t B_SS(k, k), B_SR(k, n), B_RS(n, k);
+              for (int a=0; a<k; ++a) {
+                for (int b=0; b<k; ++b) {
+                  B_SS(a, b) = B(S_[a], S_[b]);
+                }
+                for (int b=0; b<n; ++b) {
+                  B_SR(a, b) = B(S_[a], R_[b]);
+                  B_RS(b, a) = B(R_[b], S_[a]);
+                }
+              }
+              gather(S_, S_, M_SS_);
+              gather(S_, R_, M_SR_);
+              gather(R_, S_, M_RS_);
+              gather(R_, R_, M_RR_);
+
+              lu_M_SS_.compute(M_SS_);
+              W_.noalias() = M_RR_*B_RS;
+              W_.noalias() -= M_RS_*lu_M_SS_.solve(M_SR_*B_RS);
+              Z_.noalias() = B_SR*M_RR_;
+              Z_.noalias() -= (B_SR*M_RS_)*lu_M_SS_.solve(M_SR_);
+              matrix_t X(B_SS);
+              X.noalias() -= B_SR*W_;
+              lu_X_.compute(X);
+
+              const T ratio = lu_M_SS_.determinant()*lu_X_.determinant();
+              //B_RR is singular if M_SS is
+              return std::isfinite(std::abs(ratio)) ? ratio : static_cast<T>(0.0);
+            }
 
-        struct DoTransform {
-            DoTransform(std::vector<int>* v_type_map) {
-              v_type_map_ = v_type_map;
+            //accept the vertex types given to the last call of det_ratio()
+            void accept() {
+              vertex_types_.swap(vertex_types_new_);
+              if (S_.empty()) {
+                return;
+              }
+              const matrix_t X_inv = lu_X_.inverse();
+              const matrix_t W_X_inv = W_*X_inv;
+              matrix_t M_RR_new(M_RR_);
+              M_RR_new.noalias() -= M_RS_*lu_M_SS_.solve(M_SR_);
+              M_RR_new.noalias() += W_X_inv*Z_;
+              scatter(R_, R_, M_RR_new);
+              scatter(R_, S_, -W_X_inv);
+              scatter(S_, R_, -X_inv*Z_);
+              scatter(S_, S_, X_inv);
             }
 
-            itime_vertex operator()(itime_vertex v) const {
-              itime_vertex v_new(v);
-              v_new.set_vertex_type(v_type_map_->operator[](v.vertex_type()));
-              return v_new;
+            //M = (G0-alpha)^{-1} of the current configuration
+            const matrix_t& M() const {return M_;}
+
+        private:
+            //element of G0-alpha for the new vertex types
+            T B(int p, int q) const {
+              const int iv_p = p/VERTEX_RANK, rank_p = p%VERTEX_RANK, iv_q = q/VERTEX_RANK, rank_q = q%VERTEX_RANK;
+              const vertex_definition<T>& vdef_p = Uijkl_.get_vertex(vertex_types_new_[iv_p]);
+              const vertex_definition<T>& vdef_q = Uijkl_.get_vertex(vertex_types_new_[iv_q]);
+              const int flavor = vdef_p.flavors()[rank_p];
+              if (vdef_q.flavors()[rank_q]!=flavor) {
+                return 0.0;
+              }
+              T val = spline_G0_(annihilator(flavor, vdef_p.sites()[2*rank_p+1], operator_time(itime_vertices_[iv_p].time(), -rank_p)),
+                                 creator(flavor, vdef_q.sites()[2*rank_q], operator_time(itime_vertices_[iv_q].time(), -rank_q)));
+              if (p==q) {
+                val -= vdef_p.get_alpha(itime_vertices_[iv_p].af_state(), rank_p);
+              }
+              return val;
             }
 
-            std::vector<int>* v_type_map_;
+            void gather(const std::vector<int>& rows, const std::vector<int>& cols, matrix_t& mat) const {
+              mat.resize(rows.size(), cols.size());
+              for (int j=0; j<cols.size(); ++j) {
+                for (int i=0; i<rows.size(); ++i) {
+                  mat(i, j) = M_(rows[i], cols[j]);
+                }
+              }
+            }
+
+            void scatter(const std::vector<int>& rows, const std::vector<int>& cols, const matrix_t& mat) {
+              for (int j=0; j<cols.size(); ++j) {
+                for (int i=0; i<rows.size(); ++i) {
+                  M_(rows[i], cols[j]) = mat(i, j);
+                }
+              }
+            }
+
+            const general_U_matrix<T>& Uijkl_;
+            const SPLINE_G0& spline_G0_;
+            const itime_vertex_container& itime_vertices_;
+            std::vector<int> vertex_types_, vertex_types_new_;
+            matrix_t M_;
+
+            //workspace of the last proposal
+            std::vector<int> S_, R_;
+            matrix_t M_SS_, M_SR_, M_RS_, M_RR_, W_, Z_;
+            Eigen::PartialPivLU<matrix_t> lu_M_SS_, lu_X_;
         };
 
         template<typename T>
         template<typename SPLINE_G0, typename R>
         void
-        VertexUpdateManager<T>::global_updates(boost::shared_ptr<SubmatrixUpdate<T> > submatrix,
+        VertexUpdateManager<T>::global_updates(boost::shared_ptr<SubmatrixUpdate<T> >& submatrix,
         general_U_matrix<T>& Uijkl, const SPLINE_G0& spline_G0, R& random01) {
-             if (global_update_list.size() == 0) {
-               return;
-             }
+          if (global_update_list.size() == 0) {
+            return;
+          }
 
-            itime_vertex_container itime_vertices = submatrix->itime_vertices();
-            T weight = compute_weight(Uijkl, spline_G0, itime_vertices);
+          const itime_vertex_container& itime_vertices = submatrix->itime_vertices();
+          const int Nv = itime_vertices.size();
+          GlobalUpdateEvaluator<T,SPLINE_G0> evaluator(Uijkl, spline_G0, *submatrix);
+          std::vector<int> vertex_types_new(Nv);
+
+          bool accepted = false;
+          for (int i_update=0; i_update<global_update_list.size(); ++i_update) {
+            const std::vector<int>& v_type_map = global_update_list[i_update];
+            const std::vector<int>& vertex_types = evaluator.vertex_types();
+            T U_rat = 1.0;
+            for (int iv=0; iv<Nv; ++iv) {
+              vertex_types_new[iv] = v_type_map[vertex_types[iv]];
+              U_rat *= Uijkl.get_vertex(vertex_types_new[iv]).Uval()/Uijkl.get_vertex(vertex_types[iv]).Uval();
+            }
 
-            for (int i_update=0; i_update<global_update_list.size(); ++i_update) {
-                DoTransform op(&global_update_list[i_update]);
-                weight = global_update_impl(Uijkl, spline_G0, itime_vertices, op, random01, weight);
+            const T prob = U_rat*evaluator.det_ratio(vertex_types_new);
+            if (std::abs(prob)>random01()) {
+              evaluator.accept();
+              accepted = true;
             }
+          }
+
+          if (!accepted) {
+            return;
+          }
 
-            boost::shared_ptr<SubmatrixUpdate<T> > walker_new(
+          itime_vertex_container itime_vertices_new;
+          for (int iv=0; iv<Nv; ++iv) {
+            itime_vertex v(itime_vertices[iv]);
+            v.set_vertex_type(evaluator.vertex_types()[iv]);
+            itime_vertices_new.push_back(v);
+          }
+
+          boost::shared_ptr<SubmatrixUpdate<T> > walker_new(
             new SubmatrixUpdate<T>(
               submatrix->k_ins_max(), n_flavors,
-              spline_G0, &Uijkl, beta, itime_vertices)
-            );
+              spline_G0, &Uijkl, beta, itime_vertices_new)
+          );
 
-            submatrix.swap(walker_new);
+          submatrix.swap(walker_new);
         }
     }
 }
@@ -4,6 +4,8 @@
 #include <vector>
 #include <complex>
 #include <cassert>
+#include <limits>
+#include <numeric>
 #include <math.h>
 
 #include <boost/random.hpp>
@@ -399,5 +401,73 @@ namespace alps {
             std::vector<scalar_histogram> histograms;
         };
 
+
+        /**
+         * Fit c (exp(-a tau) + exp(-a (beta-tau)) + b) to the acceptance rate of an update as a function of the distance tau.
+         * counter and sumval are the number of samples and the sum of the acceptance (0 or 1) in bins of width bin_width starting at tau=0.
+         * Bins with less than min_count samples are ignored. a is chosen on a logarithmic grid and (c, c*b) by weighted least squares.
+         * Returns false and leaves a and b unchanged if there are not enough data.
+         */
+        inline bool fit_symm_exp_profile(const std::vector<double>& counter, const std::vector<double>& sumval, double bin_width,
+                                         double beta, double& a, double& b, double min_count = 10) {
+            assert(counter.size()==sumval.size());
+            const int num_bins = counter.size();
+
+            std::vector<double> x, y, w;
+            for (int i=0; i<num_bins; ++i) {
+                if (counter[i]>=min_count) {
+                    x.push_back((i+0.5)*bin_width);
+                    y.push_back(sumval[i]/counter[i]);
+                    w.push_back(counter[i]);
+                }
+            }
+            if (x.size()<3 || std::accumulate(y.begin(), y.end(), 0.0)==0.0) {
+                return false;
+            }
+
+            const int n_grid = 200;
+            const double a_min = 0.1/beta, a_max = 2.0/bin_width;
+            double best_res = std::numeric_limits<double>::max(), best_a = -1, best_b = -1;
+            for (int ig=0; ig<n_grid; ++ig) {
+                const double a_try = a_min*std::pow(a_max/a_min, ig/(n_grid-1.0));
+                double S1 = 0, Sf = 0, Sff = 0, Sy = 0, Sfy = 0;
+                for (int i=0; i<x.size(); ++i) {
+                    const double f = std::exp(-a_try*x[i])+std::exp(-a_try*(beta-x[i]));
+                    S1 += w[i];
+                    Sf += w[i]*f;
+                    Sff += w[i]*f*f;
+                    Sy += w[i]*y[i];
+                    Sfy += w[i]*f*y[i];
+                }
+                //y = c0 f + c1 with c0 > 0 and c1 >= 0
+                const double det = Sff*S1-Sf*Sf;
+                double c0 = det>0 ? (Sfy*S1-Sf*Sy)/det : 0.0;
+                double c1 = det>0 ? (Sff*Sy-Sf*Sfy)/det : 0.0;
+                if (c1<0 || det<=0) {
+                    c1 = 0.0;
+                    c0 = Sfy/Sff;
+                }
+                if (c0<=0) {
+                    continue;
+                }
+                double res = 0.0;
+                for (int i=0; i<x.size(); ++i) {
+                    const double f = std::exp(-a_try*x[i])+std::exp(-a_try*(beta-x[i]));
+                    res += w[i]*(y[i]-c0*f-c1)*(y[i]-c0*f-c1);
+                }
+                if (res<best_res) {
+                    best_res = res;
+                    best_a = a_try;
+                    best_b = c1/c0;
+                }
+            }
+            if (best_a<0) {
+                return false;
+            }
+            a = best_a;
+            b = best_b;
+            return true;
+        }
+
     }
 }
@@ -5,6 +5,8 @@
 #pragma once
 
 #include <math.h>
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
 #include <valarray>
 #include <complex>
@@ -240,6 +242,66 @@ double gen_rand_rejection_method(const P& norm_dist, double max_norm_dist, R& ra
   return x;
 };
 
+/**
+ * Walker's alias table: draws an index i with probability weights[i]/sum(weights) in O(1) using a single uniform random number.
+ */
+class WalkerAliasTable {
+public:
+  WalkerAliasTable() {}
+
+  explicit WalkerAliasTable(const std::vector<double>& weights) : prob_(weights.size()), threshold_(weights.size(), 1.0), alias_(weights.size()) {
+    const int n = weights.size();
+    double sum = 0.0;
+    for (int i=0; i<n; ++i) {
+      if (weights[i]<0.0) {
+        throw std::invalid_argument("Weights for an alias table must be non-negative.");
+      }
+      sum += weights[i];
+    }
+    if (n==0 || sum<=0.0) {
+      throw std::invalid_argument("Weights for an alias table must not be all zero.");
+    }
+
+    //split the indices into those below and above the average
+    std::vector<int> small, large;
+    std::vector<double> scaled(n);
+    for (int i=0; i<n; ++i) {
+      prob_[i] = weights[i]/sum;
+      scaled[i] = n*prob_[i];
+      alias_[i] = i;
+      (scaled[i]<1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+      const int s = small.back(), l = large.back();
+      small.pop_back();
+      threshold_[s] = scaled[s];
+      alias_[s] = l;
+      scaled[l] -= 1.0-scaled[s];
+      if (scaled[l]<1.0) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+    //remaining entries are 1 up to rounding errors
+  }
+
+  template<class R>
+  int operator()(R& random01) const {
+    const double u = random01()*threshold_.size();
+    const int i = std::min(static_cast<int>(u), static_cast<int>(threshold_.size())-1);
+    return u-i<threshold_[i] ? i : alias_[i];
+  }
+
+  //probability of drawing i
+  double probability(int i) const {return prob_[i];}
+
+  int size() const {return prob_.size();}
+
+private:
+  std::vector<double> prob_, threshold_;
+  std::vector<int> alias_;
+};
+
 
 template<typename T>
 bool my_equal(T x, T y, double eps=1E-8) {
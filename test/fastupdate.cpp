@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <map>
 
 #include "gtest.h"
 #include "common.hpp"
@@ -193,7 +194,7 @@ TEST(SubmatrixUpdate, single_vertex_insertion_spin_flip)
   general_U_matrix<T> Uijkl(n_sites, U, alpha);
 
   itime_vertex_container itime_vertices_init;
-  itime_vertices_init.push_back(itime_vertex(0, 0, 0.5*beta, 2, true));
+  itime_vertices_init.push_back(itime_vertex(0, 0, 0.5*beta, true));
 
   /* initialize submatrix_update */
   //SubmatrixUpdate<T> submatrix_update(k_ins_max, n_spins, DiagonalG0<T>(beta), &Uijkl, beta, itime_vertices_init);
@@ -252,3 +253,409 @@ TEST(SubmatrixUpdate, single_vertex_insertion_spin_flip)
 
   }
 }
+
+TEST(GlobalUpdate, det_ratio)
+{
+  typedef double T;
+  typedef Eigen::Matrix<T,Eigen::Dynamic,Eigen::Dynamic> matrix_t;
+  const int n_sites = 3;
+  const int n_spins = 2;
+  const double beta = 10.0;
+  const int Nv = 20;
+
+  std::vector<double> E(n_sites);
+  boost::multi_array<T,2> phase(boost::extents[n_sites][n_sites]);
+  for (int i=0; i<n_sites; ++i) {
+    E[i] = 0.5*i;
+    for (int j=0; j<n_sites; ++j) {
+      phase[i][j] = 1.0;
+    }
+  }
+  const G0Interpolator<T> g0(OffDiagonalG0<T>(beta, n_sites, E, phase));
+  general_U_matrix<T> Uijkl(n_sites, 2.0, 1e-2);
+
+  boost::random::mt19937 gen(100);
+  boost::random::uniform_01<> dist01;
+  itime_vertex_container itime_vertices;
+  for (int iv=0; iv<Nv; ++iv) {
+    const int type = static_cast<int>(dist01(gen)*n_sites);
+    const vertex_definition<T>& vdef = Uijkl.get_vertex(type);
+    itime_vertices.push_back(itime_vertex(type, static_cast<int>(dist01(gen)*vdef.num_af_states()), beta*dist01(gen), vdef.is_density_type()));
+  }
+  SubmatrixUpdate<T> walker(32, n_spins, g0, &Uijkl, beta, itime_vertices);
+
+  //G0-alpha of all the operators from scratch (p = VERTEX_RANK*iv+rank)
+  auto B_from_scratch = [&](const std::vector<int>& vertex_types) {
+    matrix_t B(VERTEX_RANK*Nv, VERTEX_RANK*Nv);
+    for (int p=0; p<B.rows(); ++p) {
+      for (int q=0; q<B.cols(); ++q) {
+        const int iv_p = p/VERTEX_RANK, rank_p = p%VERTEX_RANK, iv_q = q/VERTEX_RANK, rank_q = q%VERTEX_RANK;
+        const vertex_definition<T>& vdef_p = Uijkl.get_vertex(vertex_types[iv_p]);
+        const vertex_definition<T>& vdef_q = Uijkl.get_vertex(vertex_types[iv_q]);
+        const int flavor = vdef_p.flavors()[rank_p];
+        B(p,q) = vdef_q.flavors()[rank_q]!=flavor ? 0.0 :
+          g0(annihilator(flavor, vdef_p.sites()[2*rank_p+1], operator_time(itime_vertices[iv_p].time(), -rank_p)),
+             creator(flavor, vdef_q.sites()[2*rank_q], operator_time(itime_vertices[iv_q].time(), -rank_q)));
+      }
+      B(p,p) -= Uijkl.get_vertex(vertex_types[p/VERTEX_RANK]).get_alpha(itime_vertices[p/VERTEX_RANK].af_state(), p%VERTEX_RANK);
+    }
+    return B;
+  };
+
+  GlobalUpdateEvaluator<T,G0Interpolator<T> > evaluator(Uijkl, g0, walker);
+  std::vector<int> vertex_types = evaluator.vertex_types();
+  ASSERT_TRUE((evaluator.M()*B_from_scratch(vertex_types)-matrix_t::Identity(VERTEX_RANK*Nv, VERTEX_RANK*Nv)).norm()<1E-8);
+
+  //exchange of two types (only some vertices change) and cyclic permutations of sites (all vertices change)
+  for (int i_update=0; i_update<2*n_sites; ++i_update) {
+    std::vector<int> vertex_types_new(Nv);
+    for (int iv=0; iv<Nv; ++iv) {
+      const int type = vertex_types[iv];
+      vertex_types_new[iv] = i_update%2==0 ? (type<2 ? 1-type : type) : (type+1)%n_sites;
+    }
+    const T det_ratio = evaluator.det_ratio(vertex_types_new);
+    const T det_ratio_scratch = B_from_scratch(vertex_types_new).determinant()/B_from_scratch(vertex_types).determinant();
+    ASSERT_TRUE(my_equal(det_ratio, det_ratio_scratch, 1E-8)) << det_ratio << " " << det_ratio_scratch;
+
+    evaluator.accept();
+    vertex_types = vertex_types_new;
+    ASSERT_TRUE(evaluator.vertex_types()==vertex_types);
+    ASSERT_TRUE((evaluator.M()*B_from_scratch(vertex_types)-matrix_t::Identity(VERTEX_RANK*Nv, VERTEX_RANK*Nv)).norm()<1E-8);
+  }
+}
+
+TEST(ItimeVertexContainer, counters)
+{
+  const double beta = 10.0;
+  const int Nv = 50;
+
+  boost::random::mt19937 gen(100);
+  boost::random::uniform_01<> dist01;
+  itime_vertex_container itime_vertices;
+  for (int iv=0; iv<Nv; ++iv) {
+    itime_vertices.push_back(itime_vertex(iv%3, 0, beta*dist01(gen), iv%3==0));
+    itime_vertices.set_unique_id(iv, iv);
+  }
+
+  //counters
+  for (int iv=0; iv<Nv; iv+=2) {
+    itime_vertices.set_non_interacting(iv);
+  }
+  itime_vertices.set_non_interacting(0);
+  ASSERT_EQ(itime_vertices.num_interacting(), Nv/2);
+  itime_vertices.pop_back();
+  ASSERT_EQ(itime_vertices.num_interacting(), Nv/2-1);
+  itime_vertices.set_time(3, 0.5*beta);
+  ASSERT_EQ(itime_vertices[3].time(), 0.5*beta);
+
+  //removal of non-interacting vertices in place
+  std::vector<my_uint64> uid_removed;
+  itime_vertices.remove_non_interacting(uid_removed);
+  ASSERT_EQ(uid_removed.size(), Nv/2);
+  ASSERT_EQ(itime_vertices.size(), Nv/2-1);
+  ASSERT_EQ(itime_vertices.num_interacting(), Nv/2-1);
+  for (int iv=0; iv<itime_vertices.size(); ++iv) {
+    ASSERT_EQ(itime_vertices[iv].unique_id(), 2*iv+1);
+  }
+  for (int t=0; t<3; ++t) {
+    const std::vector<int>& pos = itime_vertices.interacting_positions(t);
+    ASSERT_EQ(pos.size(), std::count_if(itime_vertices.begin(), itime_vertices.end(),
+      [&](const itime_vertex& v) {return v.type()==t;}));
+    for (int i=0; i<pos.size(); ++i) {
+      ASSERT_EQ(itime_vertices[pos[i]].type(), t);
+    }
+  }
+  itime_vertices.set_non_interacting(0);
+  ASSERT_EQ(itime_vertices.num_interacting(), Nv/2-2);
+}
+
+TEST(ItimeVertexContainer, valid_pairs_by_type)
+{
+  const double beta = 10.0;
+  const int Nv = 60, n_types = 4;
+
+  boost::random::mt19937 gen(200);
+  boost::random::uniform_01<> dist01;
+  itime_vertex_container itime_vertices;
+  for (int iv=0; iv<Nv; ++iv) {
+    itime_vertices.push_back(itime_vertex(static_cast<int>(dist01(gen)*n_types), 0, beta*dist01(gen), false));
+  }
+  for (int iv=0; iv<Nv; iv+=3) {
+    itime_vertices.set_non_interacting(iv);
+  }
+  itime_vertices.set_interacting(9);
+
+  //per-type lists of interacting vertices
+  for (int t=0; t<n_types; ++t) {
+    std::vector<int> pos(itime_vertices.interacting_positions(t));
+    std::sort(pos.begin(), pos.end());
+    std::vector<int> pos_ref;
+    for (int iv=0; iv<Nv; ++iv) {
+      if (itime_vertices[iv].type()==t && !itime_vertices[iv].is_non_interacting()) {
+        pos_ref.push_back(iv);
+      }
+    }
+    ASSERT_TRUE(pos==pos_ref);
+    ASSERT_EQ(itime_vertices.num_interacting(t), pos_ref.size());
+  }
+
+  //pairs for double-vertex removals: the first vertex is chosen uniformly, its partner with probability proportional to p
+  const SymmExpDist p(2.0, 0.1, beta);
+  const std::pair<int,int> v_pair(0, 2);
+  const std::vector<int>& pos1 = itime_vertices.interacting_positions(v_pair.first);
+  const std::vector<int>& pos2 = itime_vertices.interacting_positions(v_pair.second);
+  std::map<std::pair<int,int>,double> prob_ref;
+  for (int i1=0; i1<pos1.size(); ++i1) {
+    const double t1 = itime_vertices[pos1[i1]].time();
+    const double F = sum_pair_weights(itime_vertices, v_pair.second, t1, beta, p);
+    for (int i2=0; i2<pos2.size(); ++i2) {
+      prob_ref[std::make_pair(pos1[i1], pos2[i2])] = p.bare_value(mymod(itime_vertices[pos2[i2]].time()-t1, beta))/(pos1.size()*F);
+    }
+  }
+  ASSERT_TRUE(prob_ref.size()>1);
+
+  boost::random::uniform_01<boost::random::mt19937> random01(gen);
+  const int n_samples = 100000;
+  std::map<std::pair<int,int>,int> hist;
+  for (int i=0; i<n_samples; ++i) {
+    double prob;
+    const std::pair<int,int> r = pick_up_valid_vertex_pair2(itime_vertices, v_pair, beta, p, random01, prob);
+    ASSERT_TRUE(prob_ref.find(r)!=prob_ref.end());
+    ASSERT_NEAR(prob, prob_ref[r], 1e-12);
+    ++hist[r];
+  }
+  for (auto it=prob_ref.begin(); it!=prob_ref.end(); ++it) {
+    const double mean = n_samples*it->second;
+    ASSERT_NEAR(hist[it->first], mean, 5*std::sqrt(mean)+1);
+  }
+}
+
+TEST(DoubleVertexUpdate, detailed_balance)
+{
+  const double beta = 10.0;
+  const int Nv = 40, n_types = 3;
+  const SymmExpDist p(1.5, 0.2, beta);
+
+  boost::random::mt19937 gen(300);
+  boost::random::uniform_01<> dist01;
+  itime_vertex_container itime_vertices;
+  for (int iv=0; iv<Nv; ++iv) {
+    itime_vertices.push_back(itime_vertex(static_cast<int>(dist01(gen)*n_types), 0, beta*dist01(gen), false));
+  }
+  //the pair to be inserted and removed, placed at the end as in the insertion step
+  for (int trial=0; trial<10; ++trial) {
+    const double t1 = beta*dist01(gen), t2 = beta*dist01(gen);
+    itime_vertices.push_back(itime_vertex(0, 0, t1, false));
+    itime_vertices.push_back(itime_vertex(2, 0, t2, false));
+    const int pos1 = itime_vertices.size()-2, pos2 = itime_vertices.size()-1;
+    itime_vertices.set_non_interacting(pos1);
+    itime_vertices.set_non_interacting(pos2);
+    const double corr_ins = double_vertex_insertion_corr(itime_vertices, pos1, pos2, beta, p);
+
+    itime_vertices.set_interacting(pos1);
+    itime_vertices.set_interacting(pos2);
+    const double prob = vertex_pair_removal_prob(itime_vertices, pos1, pos2, beta, p);
+    const double corr_rem = double_vertex_removal_corr(itime_vertices, pos1, pos2, prob, beta, p);
+    ASSERT_NEAR(corr_ins*corr_rem, 1.0, 1e-12);
+
+    //the proposal probability of the insertion is (1/beta) p(tau_2-tau_1)
+    ASSERT_NEAR(corr_ins, prob/(p(mymod(t2-t1, beta))/beta), 1e-10*corr_ins);
+    itime_vertices.pop_back();
+    itime_vertices.pop_back();
+  }
+}
+
+TEST(UMatrix, BinaryFile) {
+  const std::string text_file("U_matrix_test.txt"), binary_file("U_matrix_test.dat");
+  {
+    std::ofstream ofs(text_file.c_str());
+    ofs << "2\n";
+    ofs << "0 2 2 (2.0,0.0) 0 0 1 1 0 1 (1.01,0.0) (-0.01,0.0) (-0.01,0.0) (1.01,0.0)\n";
+    ofs << "1 2 2 (0.5,0.0) 0 1 1 0 0 0 (0.02,0.0) (-0.02,0.0) (-0.02,0.0) (0.02,0.0)\n";
+  }
+  U_matrix_file::write_binary(binary_file, U_matrix_file::read_text(text_file));
+  ASSERT_TRUE(U_matrix_file::is_binary(binary_file));
+  ASSERT_FALSE(U_matrix_file::is_binary(text_file));
+
+  alps::params params;
+  define_ctint_options(params);
+  params["model.sites"] = 2;
+  params["model.spins"] = 2;
+  params["model.U_matrix_file"] = text_file;
+  general_U_matrix<double> U_text(params);
+  params["model.U_matrix_file"] = binary_file;
+  general_U_matrix<double> U_binary(params);
+
+  ASSERT_EQ(2, U_binary.n_vertex_type());
+  ASSERT_EQ(1, U_binary.num_density_vertex_type());
+  for (int iv=0; iv<2; ++iv) {
+    const vertex_definition<double> &v0 = U_text.get_vertex(iv), &v1 = U_binary.get_vertex(iv);
+    ASSERT_EQ(v0.Uval(), v1.Uval());
+    ASSERT_TRUE(v0.sites()==v1.sites());
+    ASSERT_TRUE(v0.flavors()==v1.flavors());
+    for (int iaf=0; iaf<2; ++iaf) {
+      for (int i_rank=0; i_rank<2; ++i_rank) {
+        ASSERT_EQ(v0.get_alpha(iaf, i_rank), v1.get_alpha(iaf, i_rank));
+      }
+    }
+  }
+  ASSERT_EQ(0.02, U_binary.get_vertex(1).get_alpha(0, 0));
+  ASSERT_EQ(-0.02, U_binary.get_vertex(1).get_alpha(1, 0));
+
+  params["model.sites"] = 1;
+  ASSERT_THROW(general_U_matrix<double> U_invalid(params), std::runtime_error);
+
+  std::remove(text_file.c_str());
+  std::remove(binary_file.c_str());
+}
+
+TEST(UMatrix, AlphaShiftScale) {
+  const double delta = 1e-2;
+  general_U_matrix<double> Uijkl(2, 4.0, delta);
+
+  Uijkl.set_alpha_shift_scale(3.0);
+  ASSERT_EQ(2, Uijkl.num_density_vertex_type());
+  density_type pred;
+  for (int iv=0; iv<2; ++iv) {
+    ASSERT_NEAR(1+3*delta, Uijkl.get_vertex(iv).get_alpha(0, 0), 1e-12);
+    ASSERT_NEAR(-3*delta, Uijkl.get_vertex(iv).get_alpha(0, 1), 1e-12);
+    ASSERT_NEAR(1+3*delta, Uijkl.get_vertices(pred)[iv].get_alpha(1, 1), 1e-12);
+  }
+
+  //relative to the input, not to the current values
+  Uijkl.set_alpha_shift_scale(0.5);
+  ASSERT_NEAR(-0.5*delta, Uijkl.get_vertex(0).get_alpha(1, 0), 1e-12);
+
+  ASSERT_THROW(Uijkl.set_alpha_shift_scale(100.0), std::runtime_error);
+  ASSERT_THROW(Uijkl.set_alpha_shift_scale(0.0), std::invalid_argument);
+}
+
+TEST(UMatrix, AlphaShiftScaleAsymmetric) {
+  const std::string file("U_matrix_asymmetric.txt");
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "2\n";
+    ofs << "0 2 2 (2.0,0.0) 0 0 1 1 0 1 (1.01,0.0) (-0.02,0.0) (-0.03,0.0) (1.01,0.0)\n";
+    ofs << "1 2 1 (1.0,0.0) 1 1 0 0 0 1 (0.98,0.0) (0.03,0.0)\n";
+  }
+  alps::params params;
+  define_ctint_options(params);
+  params["model.sites"] = 2;
+  params["model.spins"] = 2;
+  params["model.U_matrix_file"] = file;
+  general_U_matrix<double> Uijkl(params);
+  const general_U_matrix<double> U_input(Uijkl);
+
+  //averages of alpha over the auxiliary spin states (one-body terms) do not change
+  Uijkl.set_alpha_shift_scale(2.0);
+  for (int iv=0; iv<2; ++iv) {
+    const vertex_definition<double> &v = Uijkl.get_vertex(iv), &v_input = U_input.get_vertex(iv);
+    for (int i_rank=0; i_rank<2; ++i_rank) {
+      double mean = 0.0, mean_input = 0.0;
+      for (int iaf=0; iaf<v.num_af_states(); ++iaf) {
+        mean += v.get_alpha(iaf, i_rank)/v.num_af_states();
+        mean_input += v_input.get_alpha(iaf, i_rank)/v.num_af_states();
+      }
+      ASSERT_NEAR(mean_input, mean, 1e-12);
+    }
+  }
+  ASSERT_NEAR(1.025, Uijkl.get_vertex(0).get_alpha(0, 0), 1e-12);
+  ASSERT_NEAR(0.98, Uijkl.get_vertex(1).get_alpha(0, 0), 1e-12);
+
+  //invalid scales do not modify any vertex
+  ASSERT_THROW(Uijkl.set_alpha_shift_scale(100.0), std::runtime_error);
+  ASSERT_NEAR(1.025, Uijkl.get_vertex(0).get_alpha(0, 0), 1e-12);
+
+  std::remove(file.c_str());
+}
+
+TEST(UMatrix, RotateBasis) {
+  const int n_site = 2;
+  general_U_matrix<double> Uijkl(n_site, 4.0, 1e-2);
+  general_U_matrix<double> U_rot(Uijkl);
+
+  //mixes the two sites of flavor 0 only
+  std::vector<Eigen::MatrixXd> V(2, Eigen::MatrixXd::Identity(n_site, n_site));
+  const double theta = 0.3;
+  V[0] << std::cos(theta), -std::sin(theta), std::sin(theta), std::cos(theta);
+  U_rot.rotate_basis(V);
+  ASSERT_TRUE(U_rot.n_vertex_type() > Uijkl.n_vertex_type());
+  ASSERT_TRUE(U_rot.num_density_vertex_type() < U_rot.n_vertex_type());
+
+  //quartic terms and one-body terms averaged over the auxiliary spins in the original basis
+  typedef boost::multi_array<double,6> quartic_t;
+  typedef boost::multi_array<double,3> quadratic_t;
+  auto collect = [&](const general_U_matrix<double>& U, bool rotate_back, quartic_t& U4, quadratic_t& U2) {
+    U4.resize(boost::extents[2][2][n_site][n_site][n_site][n_site]);
+    U2.resize(boost::extents[2][n_site][n_site]);
+    std::fill(U4.origin(), U4.origin() + U4.num_elements(), 0.0);
+    std::fill(U2.origin(), U2.origin() + U2.num_elements(), 0.0);
+    for (const auto& v : U.get_vertices()) {
+      const int f1 = v.flavors()[0], f2 = v.flavors()[1];
+      double mean_alpha[2] = {0.0, 0.0};
+      for (int iaf=0; iaf<v.num_af_states(); ++iaf) {
+        for (int i_rank=0; i_rank<2; ++i_rank) {
+          mean_alpha[i_rank] += v.get_alpha(iaf, i_rank)/v.num_af_states();
+        }
+      }
+      for (int i=0; i<n_site; ++i) {
+      for (int j=0; j<n_site; ++j) {
+        const double c1 = rotate_back ? V[f1](i,v.sites()[0])*V[f1](j,v.sites()[1]) : (i==v.sites()[0] && j==v.sites()[1]);
+        U2[f1][i][j] -= v.Uval()*mean_alpha[1]*c1;
+        const double c2 = rotate_back ? V[f2](i,v.sites()[2])*V[f2](j,v.sites()[3]) : (i==v.sites()[2] && j==v.sites()[3]);
+        U2[f2][i][j] -= v.Uval()*mean_alpha[0]*c2;
+        for (int k=0; k<n_site; ++k) {
+        for (int l=0; l<n_site; ++l) {
+          const double c3 = rotate_back ? V[f2](k,v.sites()[2])*V[f2](l,v.sites()[3]) : (k==v.sites()[2] && l==v.sites()[3]);
+          U4[f1][f2][i][j][k][l] += v.Uval()*c1*c3;
+        }
+        }
+      }
+      }
+    }
+  };
+  auto check_equivalent = [&](const general_U_matrix<double>& U, const general_U_matrix<double>& U_rotated) {
+    quartic_t U4, U4_rot;
+    quadratic_t U2, U2_rot;
+    collect(U, false, U4, U2);
+    collect(U_rotated, true, U4_rot, U2_rot);
+    for (int i=0; i<U4.num_elements(); ++i) {
+      ASSERT_NEAR(U4.origin()[i], U4_rot.origin()[i], 1e-10);
+    }
+    for (int i=0; i<U2.num_elements(); ++i) {
+      ASSERT_NEAR(U2.origin()[i], U2_rot.origin()[i], 1e-10);
+    }
+  };
+  check_equivalent(Uijkl, U_rot);
+
+  ASSERT_THROW(U_rot.rotate_basis(std::vector<Eigen::MatrixXd>(1, V[0])), std::invalid_argument);
+
+  //asymmetric alpha values of a density pair and a non-density vertex, both flavors rotated
+  const std::string file("U_matrix_rotate.txt");
+  alps::params params;
+  define_ctint_options(params);
+  params["model.sites"] = n_site;
+  params["model.spins"] = 2;
+  params["model.U_matrix_file"] = file;
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "2\n";
+    ofs << "0 2 2 (2.0,0.0) 0 0 1 1 0 1 (1.01,0.0) (-0.02,0.0) (-0.03,0.0) (1.01,0.0)\n";
+    ofs << "1 2 2 (0.5,0.0) 0 1 1 0 0 1 (0.02,0.0) (-0.02,0.0) (0.02,0.0) (-0.02,0.0)\n";
+  }
+  general_U_matrix<double> U_file(params), U_file_rot(params);
+  V[1] << std::cos(0.7), std::sin(0.7), -std::sin(0.7), std::cos(0.7);
+  U_file_rot.rotate_basis(V);
+  check_equivalent(U_file, U_file_rot);
+
+  //the one-body terms of a non-density pair with a non-zero average of alpha cannot be preserved
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "1\n";
+    ofs << "0 2 2 (0.5,0.0) 0 1 1 0 0 1 (0.03,0.0) (-0.01,0.0) (0.02,0.0) (-0.02,0.0)\n";
+  }
+  general_U_matrix<double> U_invalid(params);
+  ASSERT_THROW(U_invalid.rotate_basis(V), std::invalid_argument);
+
+  std::remove(file.c_str());
+}
@@ -2,6 +2,7 @@
 
 #include <complex>
 #include <limits>
+#include <numeric>
 
 #include <boost/math/special_functions/binomial.hpp>
 #include <boost/random.hpp>
@@ -9,9 +10,15 @@
 #include <boost/range/irange.hpp>
 
 #include "../src/legendre.h"
+#include "../src/basis.hpp"
+#include "../src/basis_rotation.hpp"
 #include "../src/util.h"
 #include "../src/green_function.h"
 #include "../src/spline.h"
+#include "../src/equilibration.hpp"
+#include "../src/binning.hpp"
+#include "../src/update_statistics.h"
+#include "../src/nfft.hpp"
 
 #include "gtest.h"
 #include "common.hpp"
@@ -62,6 +69,49 @@ TEST(LegendreMeasurement, Tnl)
     }
 }
 
+//G(i omega_n) = 1/(omega0 - i omega_n) of G(tau) = exp(-omega0 tau)/(1+exp(-beta omega0)) is reconstructed from the coefficients
+void check_basis_reconstruction(const BasisTransformer &basis, double beta, double omega0, double tol) {
+    const int n_sections = 64;
+    std::vector<double> x, weights;
+    for (int s = 0; s < n_sections; ++s) {
+        std::vector<double> x_s, w_s;
+        gauss_legendre(16, -1.0 + 2.0 * s / n_sections, -1.0 + 2.0 * (s + 1) / n_sections, x_s, w_s);
+        x.insert(x.end(), x_s.begin(), x_s.end());
+        weights.insert(weights.end(), w_s.begin(), w_s.end());
+    }
+    boost::multi_array<double, 2> W(boost::extents[basis.size()][x.size()]);
+    basis.compute_projectors(x, W);
+
+    Eigen::VectorXcd coeffs(basis.size());
+    for (int l = 0; l < basis.size(); ++l) {
+        double sum = 0.0;
+        for (int i = 0; i < x.size(); ++i) {
+            const double tau = 0.5 * beta * (x[i] + 1);
+            sum += 0.5 * beta * weights[i] * W[l][i] * std::exp(-omega0 * tau) / (1 + std::exp(-beta * omega0));
+        }
+        coeffs[l] = sum;
+    }
+    const Eigen::VectorXcd Gw = basis.Tnl() * coeffs;
+    for (int n = 0; n < Gw.size(); ++n) {
+        const std::complex<double> exact = 1.0 / std::complex<double>(omega0, -(2 * n + 1) * M_PI / beta);
+        ASSERT_NEAR(std::abs(Gw[n] - exact), 0.0, tol) << basis.name() << " n = " << n;
+    }
+}
+
+TEST(BasisTransformer, Reconstruction)
+{
+    const double beta = 10.0, omega0 = 1.0;
+    const int n_matsubara = 100;
+
+    check_basis_reconstruction(LegendreBasis(n_matsubara, 60), beta, omega0, 1e-8);
+
+    //IR basis for beta * omega_max = 100: a few tens of functions give a comparable accuracy
+    IRBasis ir(n_matsubara, beta, 100.0, 1e-8);
+    ASSERT_TRUE(ir.size() < 30) << ir.size();
+    check_basis_reconstruction(ir, beta, omega0, 1e-7);
+    check_basis_reconstruction(ir, beta, -5.0, 1e-7);
+}
+
 
 TEST(Boost, Binomial) {
     const size_t k = 2;
@@ -84,4 +134,183 @@ TEST(Util, Mymod) {
     }
 }
 
+TEST(Util, WalkerAliasTable) {
+    std::vector<double> weights;
+    weights.push_back(1.0);
+    weights.push_back(0.0);
+    weights.push_back(1E-3);
+    weights.push_back(5.0);
+    weights.push_back(2.5);
+    const double sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+    WalkerAliasTable table(weights);
+    ASSERT_EQ(table.size(), weights.size());
+
+    boost::random::mt19937 gen(100);
+    boost::random::uniform_01<> dist;
+    boost::random::variate_generator<boost::random::mt19937&, boost::random::uniform_01<> > random01(gen, dist);
+
+    const int n_samples = 1000000;
+    std::vector<double> hist(weights.size(), 0.0);
+    for (int i=0; i<n_samples; ++i) {
+        ++hist[table(random01)];
+    }
+    for (int i=0; i<weights.size(); ++i) {
+        ASSERT_NEAR(table.probability(i), weights[i]/sum, 1E-12);
+        ASSERT_NEAR(hist[i]/n_samples, weights[i]/sum, 5*std::sqrt(weights[i]/sum/n_samples)+1E-10);
+    }
+    ASSERT_EQ(hist[1], 0.0);
+
+    ASSERT_THROW(WalkerAliasTable(std::vector<double>(3, 0.0)), std::invalid_argument);
+}
+
+TEST(Util, FitSymmExpProfile) {
+    const double beta = 10.0, a = 2.0, b = 0.05;
+    const int num_bins = 100;
+
+    //noiseless acceptance profile on [0, beta/2] (distances of two vertices)
+    std::vector<double> counter(num_bins, 0.0), sumval(num_bins, 0.0);
+    for (int i=0; i<num_bins/2; ++i) {
+        const double x = (i+0.5)*beta/num_bins;
+        counter[i] = 1000;
+        sumval[i] = 1000*0.3*(std::exp(-a*x)+std::exp(-a*(beta-x))+b);
+    }
+
+    double a_fit = 1.0, b_fit = 0.1;
+    ASSERT_TRUE(fit_symm_exp_profile(counter, sumval, beta/num_bins, beta, a_fit, b_fit));
+    ASSERT_NEAR(a_fit, a, 0.05*a);
+    ASSERT_NEAR(b_fit, b, 0.01);
+
+    //not enough data
+    std::vector<double> counter_empty(num_bins, 0.0);
+    ASSERT_FALSE(fit_symm_exp_profile(counter_empty, sumval, beta/num_bins, beta, a_fit, b_fit));
+}
+
+TEST(Util, EquilibrationDetector) {
+    boost::random::mt19937 gen(100);
+    boost::random::normal_distribution<> noise(0.0, 1.0);
+
+    EquilibrationDetector detector(1, 100, 2.0);
+
+    //linear drift followed by a plateau
+    const int n_drift = 2000;
+    std::vector<double> sample(1);
+    for (int i=0; i<n_drift; ++i) {
+        sample[0] = 100.0*i/n_drift + noise(gen);
+        detector.add_sample(sample);
+        ASSERT_FALSE(detector.is_stationary()) << " at step " << i;
+    }
+
+    int i_detected = -1;
+    for (int i=0; i<10*n_drift; ++i) {
+        sample[0] = 100.0 + noise(gen);
+        detector.add_sample(sample);
+        if (detector.is_stationary()) {
+            i_detected = i;
+            break;
+        }
+    }
+    ASSERT_TRUE(i_detected >= 0);
+    ASSERT_TRUE(i_detected < 5*n_drift);
+}
+
+TEST(Util, BinningAnalysis) {
+    //AR(1) process: tau_int = sum_{k>=1} rho^k = rho/(1-rho)
+    const double rho = 0.8;
+    const double tau_int_exact = rho/(1-rho);
+
+    //The estimate of a single run at the converged level (32-63 bins) fluctuates by about 20%,
+    //so the estimates are averaged over independent runs and compared within their statistical error.
+    const int n_runs = 64, n_samples = 1000000;
+    std::vector<double> tau_int(n_runs);
+    for (int run=0; run<n_runs; ++run) {
+        boost::random::mt19937 gen(100+run);
+        boost::random::normal_distribution<> noise(0.0, 1.0);
+
+        BinningAnalysis binning;
+        double x = 0.0;
+        for (int i=0; i<n_samples; ++i) {
+            x = rho*x + noise(gen);
+            binning.add_sample(x);
+            if (i+1 == 1000) {
+                ASSERT_FALSE(binning.is_reliable(6));
+            }
+        }
+        ASSERT_EQ(binning.count(), n_samples);
+        ASSERT_TRUE(binning.is_reliable(6));
+        ASSERT_TRUE(std::abs(binning.mean()) < 5*binning.error());
+        ASSERT_NEAR(binning.effective_count(), n_samples/(1+2*binning.tau_int()), 1e-8*n_samples);
+        tau_int[run] = binning.tau_int();
+    }
+
+    const double mean = std::accumulate(tau_int.begin(), tau_int.end(), 0.0)/n_runs;
+    double var = 0.0;
+    for (int run=0; run<n_runs; ++run) {
+        var += (tau_int[run]-mean)*(tau_int[run]-mean);
+    }
+    const double error = std::sqrt(var/(n_runs-1)/n_runs);
+    ASSERT_TRUE(error < 0.05*tau_int_exact) << "error = " << error;
+    ASSERT_TRUE(std::abs(mean-tau_int_exact) < 4*error) << "tau_int = " << mean << " +/- " << error;
+}
+
+TEST(Util, NonEquispacedFourierTransform) {
+    boost::random::mt19937 gen(100);
+    boost::random::uniform_real_distribution<> dist(0.0, 1.0);
+
+    const int n_freq = 100, n_points = 500;
+    NonEquispacedFourierTransform nfft(n_freq, 2);
+
+    std::vector<double> theta(n_points);
+    std::vector<std::complex<double> > values(2*n_points);
+    for (int j=0; j<n_points; ++j) {
+        theta[j] = 2*M_PI*dist(gen);
+        values[2*j] = std::complex<double>(dist(gen), dist(gen));
+        values[2*j+1] = std::complex<double>(dist(gen), dist(gen));
+        nfft.add(theta[j], &values[2*j], 0, 2);
+    }
+
+    std::vector<std::complex<double> > result;
+    for (int i_data=0; i_data<2; ++i_data) {
+        nfft.transform(i_data, result);
+        for (int n=0; n<n_freq; ++n) {
+            std::complex<double> direct = 0.0;
+            for (int j=0; j<n_points; ++j) {
+                direct += values[2*j+i_data]*std::exp(std::complex<double>(0.0, n*theta[j]));
+            }
+            ASSERT_TRUE(std::abs(result[n]-direct) < 1e-9) << "n = " << n;
+        }
+    }
+}
+
+TEST(Util, JointDiagonalizer) {
+    boost::random::mt19937 gen(100);
+    boost::random::uniform_real_distribution<> dist(-1.0, 1.0);
 
+    const int N = 4, n_mats = 5;
+    Eigen::MatrixXd R(N, N);
+    for (int i=0; i<N; ++i) {
+        for (int j=0; j<N; ++j) {
+            R(i,j) = dist(gen);
+        }
+    }
+    const Eigen::MatrixXd Q = Eigen::HouseholderQR<Eigen::MatrixXd>(R).householderQ();
+
+    std::vector<Eigen::MatrixXd> mats;
+    for (int k=0; k<n_mats; ++k) {
+        Eigen::MatrixXd D = Eigen::MatrixXd::Zero(N, N);
+        for (int i=0; i<N; ++i) {
+            D(i,i) = dist(gen);
+        }
+        mats.push_back(Q * D * Q.transpose());
+    }
+    ASSERT_TRUE(off_diagonal_weight(mats, Eigen::MatrixXd::Identity(N, N)) > 1e-2);
+
+    const Eigen::MatrixXd V = joint_diagonalizer(mats);
+    ASSERT_TRUE((V.transpose() * V - Eigen::MatrixXd::Identity(N, N)).norm() < 1e-10);
+    ASSERT_TRUE(off_diagonal_weight(mats, V) < 1e-16);
+    //V equals Q up to the order and signs of the columns
+    const Eigen::MatrixXd P = Q.transpose() * V;
+    for (int i=0; i<N; ++i) {
+        ASSERT_NEAR(1.0, P.row(i).cwiseAbs().maxCoeff(), 1e-8);
+    }
+}